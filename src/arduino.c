@@ -130,4 +130,7 @@ void arduino_initpgm(PROGRAMMER * pgm)
   pgm->read_sig_bytes = arduino_read_sig_bytes;
   pgm->open = arduino_open;
   pgm->close = arduino_close;
+
+  /* the bootloader may ignore or only partly do a chip erase */
+  pgm->erase_blanks = 0;
 }
@@ -303,17 +303,14 @@ int avr_mem_hiaddr(AVRMEM * mem)
  * Read the entirety of the specified memory type into the
  * corresponding buffer of the avrpart pointed to by 'p'.
  * If v is non-NULL, verify against v's memory area, only
- * those cells that are tagged TAG_ALLOCATED are verified.
+ * those cells that are allocated in v are verified.
  *
  * Return the number of bytes read, or < 0 if an error occurs.  
  */
 int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
              AVRPART * v)
 {
-  unsigned long    i, lastaddr;
-  unsigned char    cmd[4];
   AVRMEM * mem, * vmem = NULL;
-  int rc;
 
   mem = avr_locate_mem(p, memtype);
   if (v != NULL)
@@ -324,6 +321,39 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
     return -1;
   }
 
+  return avr_read_mem(pgm, p, mem, vmem);
+}
+
+
+/*
+ * Read the entirety of memory 'mem' of part 'p' into its buffer.
+ * If vmem is non-NULL, only the pages (or bytes) containing cells
+ * allocated in vmem are read, vmem is typically the image of an
+ * input file to be verified against.
+ *
+ * Return the number of bytes read, or < 0 if an error occurs.
+ */
+int avr_read_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, AVRMEM * vmem)
+{
+  return avr_read_mem_cb(pgm, p, mem, vmem, NULL, NULL);
+}
+
+
+/*
+ * Like avr_read_mem(), but call cb (if non-NULL) for each range of
+ * memory as soon as it has been read, in ascending address order.
+ * Ranges are whole pages, or the entire memory if it is read in one
+ * go.  If the read has to fall back to the byte-at-a-time method
+ * half way, ranges already reported can be reported again.  If cb
+ * returns a negative value, reading stops and that value is returned.
+ */
+int avr_read_mem_cb(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, AVRMEM * vmem,
+                    FP_ReadPageCallback cb, void * cookie)
+{
+  unsigned long    i, lastaddr, cbaddr;
+  unsigned char    cmd[4];
+  int rc;
+
   /*
    * start with all 0xff
    */
@@ -339,9 +369,8 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
     avr_tpi_setup_rw(pgm, mem, 0, TPI_NVMCMD_NO_OPERATION);
 
     /* load bytes */
-    for (lastaddr = i = 0; i < mem->size; i++) {
-      if (vmem == NULL ||
-          (vmem->tags[i] & TAG_ALLOCATED) != 0)
+    for (lastaddr = i = cbaddr = 0; i < mem->size; i++) {
+      if (vmem == NULL || avr_mem_tagged(vmem, i, 1))
       {
         if (lastaddr != i) {
           /* need to setup new address */
@@ -356,6 +385,12 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
           return -1;
         }
       }
+      if (cb != NULL && ((i + 1) % mem->page_size == 0 || i + 1 == mem->size)) {
+        rc = cb(mem, cbaddr, i + 1 - cbaddr, cookie);
+        if (rc < 0)
+          return rc;
+        cbaddr = i + 1;
+      }
       report_progress(i, mem->size, NULL);
     }
     return avr_mem_hiaddr(mem);
@@ -370,45 +405,34 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
     unsigned int pageaddr;
     unsigned int npages, nread;
 
-    /* quickly scan number of pages to be written to first */
+    /* quickly scan number of pages to be read first */
     for (pageaddr = 0, npages = 0;
          pageaddr < mem->size;
          pageaddr += mem->page_size) {
-      /* check whether this page must be read */
-      for (i = pageaddr;
-           i < pageaddr + mem->page_size;
-           i++)
-        if (vmem == NULL /* no verify, read everything */ ||
-            (mem->tags[i] & TAG_ALLOCATED) != 0 /* verify, do only
-                                                    read pages that
-                                                    are needed in
-                                                    input file */) {
-          npages++;
-          break;
-        }
+      if (vmem == NULL || avr_mem_tagged(vmem, pageaddr, mem->page_size))
+        npages++;
     }
 
     for (pageaddr = 0, failure = 0, nread = 0;
          !failure && pageaddr < mem->size;
          pageaddr += mem->page_size) {
       /* check whether this page must be read */
-      for (i = pageaddr, need_read = 0;
-           i < pageaddr + mem->page_size;
-           i++)
-        if (vmem == NULL /* no verify, read everything */ ||
-            (vmem->tags[i] & TAG_ALLOCATED) != 0 /* verify, do only
-                                                    read pages that
-                                                    are needed in
-                                                    input file */) {
-          need_read = 1;
-          break;
-        }
+      need_read = vmem == NULL /* no verify, read everything */ ||
+        avr_mem_tagged(vmem, pageaddr, mem->page_size) /* verify, do only
+                                                          read pages that
+                                                          are needed in
+                                                          input file */;
       if (need_read) {
         rc = pgm->paged_load(pgm, p, mem, mem->page_size,
                             pageaddr, mem->page_size);
         if (rc < 0)
           /* paged load failed, fall back to byte-at-a-time read below */
           failure = 1;
+        else if (cb != NULL) {
+          rc = cb(mem, pageaddr, mem->page_size, cookie);
+          if (rc < 0)
+            return rc;
+        }
       } else {
         avrdude_message(MSG_DEBUG, "%s: avr_read(): skipping page %u: no interesting data\n",
                         progname, pageaddr / mem->page_size);
@@ -430,27 +454,38 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
 
   if (strcmp(mem->desc, "signature") == 0) {
     if (pgm->read_sig_bytes) {
-      return pgm->read_sig_bytes(pgm, p, mem);
+      rc = pgm->read_sig_bytes(pgm, p, mem);
+      if (rc >= 0 && cb != NULL) {
+        int cbrc = cb(mem, 0, mem->size, cookie);
+        if (cbrc < 0)
+          return cbrc;
+      }
+      return rc;
     }
   }
 
-  for (i=0; i < mem->size; i++) {
-    if (vmem == NULL ||
-	(vmem->tags[i] & TAG_ALLOCATED) != 0)
+  for (i=0, cbaddr=0; i < mem->size; i++) {
+    if (vmem == NULL || avr_mem_tagged(vmem, i, 1))
     {
       rc = pgm->read_byte(pgm, p, mem, i, mem->buf + i);
       if (rc != 0) {
         avrdude_message(MSG_INFO, "avr_read(): error reading address 0x%04lx\n", i);
         if (rc == -1) {
           avrdude_message(MSG_INFO, "    read operation not supported for memory \"%s\"\n",
-                          memtype);
+                          mem->desc);
           return -2;
         }
         avrdude_message(MSG_INFO, "    read operation failed for memory \"%s\"\n",
-                        memtype);
+                        mem->desc);
         return rc;
       }
     }
+    if (cb != NULL && ((i + 1) % mem->page_size == 0 || i + 1 == mem->size)) {
+      rc = cb(mem, cbaddr, i + 1 - cbaddr, cookie);
+      if (rc < 0)
+        return rc;
+      cbaddr = i + 1;
+    }
     report_progress(i, mem->size, NULL);
   }
 
@@ -464,6 +499,91 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
 }
 
 
+/*
+ * Book-keeping for avr_wait_ready(), reported by avr_ready_report().
+ */
+static struct {
+  unsigned long waits;          /* waits satisfied by RDY/BSY polling */
+  unsigned long polls;          /* poll_ready instructions issued */
+  unsigned long timeouts;       /* polls that ran into the fixed delay */
+  double delay_us;              /* fixed delays that would have been slept */
+  double spent_us;              /* time actually spent polling */
+} ready_stats;
+
+
+/*
+ * Wait for a pending write or erase operation to complete.  If the
+ * part has a poll_ready instruction and the programmer can issue raw
+ * ISP commands, poll the RDY/BSY flag until the device is ready or
+ * max_us microseconds have passed; otherwise just sleep for max_us.
+ *
+ * Returns 0 once the device is (assumed to be) ready, -1 if polling
+ * timed out.
+ */
+int avr_wait_ready(PROGRAMMER * pgm, AVRPART * p, unsigned int max_us)
+{
+  unsigned char cmd[4];
+  unsigned char res[4];
+  unsigned char busy;
+  OPCODE * op;
+  struct timeval tv;
+  unsigned long start_time, now;
+
+  op = p->op[AVR_OP_POLL_READY];
+  if (op == NULL || pgm->cmd == NULL) {
+    usleep(max_us);
+    return 0;
+  }
+
+  gettimeofday(&tv, NULL);
+  start_time = (tv.tv_sec * 1000000) + tv.tv_usec;
+  do {
+    memset(cmd, 0, sizeof(cmd));
+    avr_set_bits(op, cmd);
+    if (pgm->cmd(pgm, cmd, res) < 0) {
+      /* programmer can't poll after all, fall back to the fixed delay */
+      usleep(max_us);
+      return 0;
+    }
+    ready_stats.polls++;
+    busy = 0;
+    avr_get_output(op, res, &busy);
+    gettimeofday(&tv, NULL);
+    now = (tv.tv_sec * 1000000) + tv.tv_usec;
+  } while ((busy & 1) && now - start_time < max_us);
+
+  ready_stats.waits++;
+  ready_stats.delay_us += max_us;
+  ready_stats.spent_us += now - start_time;
+  if (busy & 1) {
+    ready_stats.timeouts++;
+    avrdude_message(MSG_DEBUG, "%s: avr_wait_ready(): device still busy after %u us\n",
+                    progname, max_us);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Summarize the time saved by RDY/BSY polling compared to the fixed
+ * delays from the configuration file.
+ */
+void avr_ready_report(void)
+{
+  if (ready_stats.waits == 0)
+    return;
+
+  avrdude_message(MSG_NOTICE, "%s: RDY/BSY polling: %lu waits, %lu polls, %lu timeouts\n"
+                  "%s: %.1f ms spent waiting instead of %.1f ms of fixed delays "
+                  "(%.1f ms saved)\n",
+                  progname, ready_stats.waits, ready_stats.polls, ready_stats.timeouts,
+                  progname, ready_stats.spent_us / 1000, ready_stats.delay_us / 1000,
+                  (ready_stats.delay_us - ready_stats.spent_us) / 1000);
+}
+
+
 /*
  * write a page data at the specified address
  */
@@ -518,9 +638,10 @@ int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
   /*
    * since we don't know what voltage the target AVR is powered by, be
-   * conservative and delay the max amount the spec says to wait
+   * conservative and delay the max amount the spec says to wait, unless
+   * the device can tell us when it is done
    */
-  usleep(mem->max_write_delay);
+  avr_wait_ready(pgm, p, mem->max_write_delay);
 
   pgm->pgm_led(pgm, OFF);
   return 0;
@@ -680,9 +801,9 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   if (readok == 0) {
     /*
      * read operation not supported for this memory type, just wait
-     * the max programming time and then return 
+     * the max programming time (or poll RDY/BSY) and then return
      */
-    usleep(mem->max_write_delay); /* maximum write delay */
+    avr_wait_ready(pgm, p, mem->max_write_delay);
     pgm->pgm_led(pgm, OFF);
     return 0;
   }
@@ -697,9 +818,9 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
        * use an extra long delay when we happen to be writing values
        * used for polled data read-back.  In this case, polling
        * doesn't work, and we need to delay the worst case write time
-       * specified for the chip.
+       * specified for the chip, or poll RDY/BSY if the part has it.
        */
-      usleep(mem->max_write_delay);
+      avr_wait_ready(pgm, p, mem->max_write_delay);
       rc = pgm->read_byte(pgm, p, mem, addr, &r);
       if (rc != 0) {
         pgm->pgm_led(pgm, OFF);
@@ -831,14 +952,7 @@ int avr_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size, 
               int auto_erase)
 {
-  int              rc;
-  int              newpage, page_tainted, flush_page, do_write;
-  int              wsize;
-  unsigned int     i, lastaddr;
-  unsigned char    data;
-  int              werror;
-  unsigned char    cmd[4];
-  AVRMEM         * m;
+  AVRMEM * m;
 
   m = avr_locate_mem(p, memtype);
   if (m == NULL) {
@@ -847,6 +961,82 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
     return -1;
   }
 
+  return avr_write_mem(pgm, p, m, size, auto_erase, 0, 0, NULL);
+}
+
+
+/*
+ * Tell whether the 'len' bytes of the buffer of 'm' starting at 'addr'
+ * all hold the erased value 0xff.
+ */
+static int avr_mem_blank(AVRMEM * m, unsigned int addr, unsigned int len)
+{
+  unsigned char * b = m->buf + addr;
+
+  if (addr + len > m->size)
+    len = m->size - addr;
+  while (len > 0 && *b == 0xff) {
+    b++;
+    len--;
+  }
+
+  return len == 0;
+}
+
+
+/*
+ * Read back the page at 'pageaddr' in paged mode, and tell whether
+ * the device already holds exactly what the buffer of 'm' contains
+ * for that page.  The buffer itself is left alone; 'scratch' must
+ * hold one page.
+ */
+static int avr_page_unchanged(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                              unsigned int pageaddr, unsigned char * scratch)
+{
+  int rc;
+
+  memcpy(scratch, m->buf + pageaddr, m->page_size);
+  rc = pgm->paged_load(pgm, p, m, m->page_size, pageaddr, m->page_size);
+  if (rc >= 0)
+    rc = memcmp(scratch, m->buf + pageaddr, m->page_size) == 0;
+  memcpy(m->buf + pageaddr, scratch, m->page_size);
+
+  return rc > 0;
+}
+
+
+/*
+ * Write memory 'm' of part 'p' from its buffer, as avr_write() does.
+ *
+ * If 'incremental' is set and the programmer supports paged reads,
+ * each page to be written is read back first, and only erased and
+ * written if its contents differ from the buffer.  The number of
+ * pages found unchanged is returned in *nskipped unless that is
+ * NULL.
+ *
+ * If 'erased' is set, the chip has just been erased, and pages of
+ * flash that consist of 0xff only are not written at all.  They are
+ * counted in *nskipped as well.
+ */
+int avr_write_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m, int size,
+                  int auto_erase, int incremental, int erased,
+                  int * nskipped)
+{
+  int              rc;
+  int              newpage, page_tainted, flush_page, do_write, blank;
+  int              nblank;
+  int              wsize;
+  unsigned int     i, lastaddr;
+  unsigned char    data;
+  int              werror;
+  unsigned char    cmd[4];
+
+  if (nskipped)
+    *nskipped = 0;
+  if (erased && !avr_mem_is_flash_type(m))
+    erased = 0;
+  nblank = 0;
+
   pgm->err_led(pgm, OFF);
 
   werror  = 0;
@@ -878,9 +1068,14 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
     }
 
     /* write words, low byte first */
-    for (lastaddr = i = 0; i < wsize; i += 2) {
-      if ((m->tags[i] & TAG_ALLOCATED) != 0 ||
-          (m->tags[i + 1] & TAG_ALLOCATED) != 0) {
+    for (blank = 0, lastaddr = i = 0; i < wsize; i += 2) {
+      if (erased && i % m->page_size == 0) {
+        blank = avr_mem_tagged(m, i, m->page_size) &&
+          avr_mem_blank(m, i, m->page_size);
+        if (blank)
+          nblank++;
+      }
+      if (!blank && avr_mem_tagged(m, i, 2)) {
 
         if (lastaddr != i) {
           /* need to setup new address */
@@ -901,6 +1096,8 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
       }
       report_progress(i, wsize, NULL);
     }
+    if (nskipped)
+      *nskipped = nblank;
     return i;
   }
 
@@ -911,33 +1108,40 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
     int need_write, failure;
     unsigned int pageaddr;
     unsigned int npages, nwritten;
+    int nsame;
+    unsigned char * scratch = NULL;
+
+    if (incremental && pgm->paged_load != NULL) {
+      scratch = malloc(m->page_size);
+      if (scratch == NULL) {
+        avrdude_message(MSG_INFO, "%s: avr_write(): out of memory\n", progname);
+        return -1;
+      }
+    }
 
     /* quickly scan number of pages to be written to first */
     for (pageaddr = 0, npages = 0;
          pageaddr < wsize;
          pageaddr += m->page_size) {
-      /* check whether this page must be written to */
-      for (i = pageaddr;
-           i < pageaddr + m->page_size;
-           i++)
-        if ((m->tags[i] & TAG_ALLOCATED) != 0) {
-          npages++;
-          break;
-        }
+      if (avr_mem_tagged(m, pageaddr, m->page_size))
+        npages++;
     }
 
-    for (pageaddr = 0, failure = 0, nwritten = 0;
+    for (pageaddr = 0, failure = 0, nwritten = 0, nsame = 0;
          !failure && pageaddr < wsize;
          pageaddr += m->page_size) {
       /* check whether this page must be written to */
-      for (i = pageaddr, need_write = 0;
-           i < pageaddr + m->page_size;
-           i++)
-        if ((m->tags[i] & TAG_ALLOCATED) != 0) {
-          need_write = 1;
-          break;
-        }
-      if (need_write) {
+      need_write = avr_mem_tagged(m, pageaddr, m->page_size);
+      if (need_write && erased && avr_mem_blank(m, pageaddr, m->page_size)) {
+        avrdude_message(MSG_DEBUG, "%s: avr_write(): skipping page %u: blank\n",
+                        progname, pageaddr / m->page_size);
+        nblank++;
+      } else if (need_write && scratch != NULL &&
+          avr_page_unchanged(pgm, p, m, pageaddr, scratch)) {
+        avrdude_message(MSG_DEBUG, "%s: avr_write(): skipping page %u: unchanged\n",
+                        progname, pageaddr / m->page_size);
+        nsame++;
+      } else if (need_write) {
         rc = 0;
         if (auto_erase)
           rc = pgm->page_erase(pgm, p, m, pageaddr);
@@ -953,8 +1157,13 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
       nwritten++;
       report_progress(nwritten, npages, NULL);
     }
-    if (!failure)
+    free(scratch);
+    if (!failure) {
+      if (nskipped)
+        *nskipped = nsame + nblank;
       return wsize;
+    }
+    nblank = 0;
     /* else: fall back to byte-at-a-time write, for historical reasons */
   }
 
@@ -965,25 +1174,40 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
   newpage = 1;
   page_tainted = 0;
   flush_page = 0;
+  blank = 0;
 
   for (i=0; i<wsize; i++) {
     data = m->buf[i];
     report_progress(i, wsize, NULL);
 
+    /*
+     * After a chip erase, a page that is all 0xff is left out as a
+     * whole, rather than byte by byte, as some programmers cache the
+     * page they are writing to.
+     */
+    if (erased && i % m->page_size == 0) {
+      blank = avr_mem_tagged(m, i, m->page_size) &&
+        avr_mem_blank(m, i, m->page_size);
+      if (blank)
+        nblank++;
+    }
+    if (blank)
+      continue;
+
     /*
      * Find out whether the write action must be invoked for this
      * byte.
      *
-     * For non-paged memory, this only happens if TAG_ALLOCATED is
-     * set for the byte.
+     * For non-paged memory, this only happens if the byte is
+     * allocated.
      *
-     * For paged memory, TAG_ALLOCATED also invokes the write
+     * For paged memory, an allocated byte also invokes the write
      * operation, which is actually a page buffer fill only.  This
      * "taints" the page, and upon encountering the last byte of each
      * tainted page, the write operation must also be invoked in order
      * to actually write the page buffer to memory.
      */
-    do_write = (m->tags[i] & TAG_ALLOCATED) != 0;
+    do_write = avr_mem_tagged(m, i, 1);
     if (m->paged) {
       if (newpage) {
         page_tainted = do_write;
@@ -1040,11 +1264,156 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
     }
   }
 
+  if (nskipped)
+    *nskipped = nblank;
+
   return i;
 }
 
 
 
+/*
+ * SCK periods (in microseconds) tried by avr_tune_sck(), fastest
+ * first.
+ */
+static const double sck_periods[] = {
+  0.125, 0.25, 0.5, 1, 2, 4, 8, 16, 32, 64, 128, 256
+};
+
+#define SCK_NPERIODS (sizeof(sck_periods) / sizeof(sck_periods[0]))
+#define SCK_MAXREAD  256
+
+/*
+ * Read the signature, and the start of flash, into sig and data.
+ * Return the number of flash bytes read, or -1.
+ */
+static int avr_sck_sample(PROGRAMMER * pgm, AVRPART * p, AVRMEM * sigm,
+                          AVRMEM * flash, unsigned char * sig,
+                          unsigned char * data)
+{
+  int i, n, rc;
+
+  if (pgm->read_sig_bytes) {
+    if (pgm->read_sig_bytes(pgm, p, sigm) < 0)
+      return -1;
+  } else {
+    for (i = 0; i < sigm->size; i++)
+      if (pgm->read_byte(pgm, p, sigm, i, sigm->buf + i) != 0)
+        return -1;
+  }
+  memcpy(sig, sigm->buf, sigm->size);
+
+  if (flash == NULL)
+    return 0;
+
+  if (flash->paged && flash->page_size > 1 && pgm->paged_load != NULL) {
+    n = flash->page_size < SCK_MAXREAD? flash->page_size: SCK_MAXREAD;
+    rc = pgm->paged_load(pgm, p, flash, flash->page_size, 0, flash->page_size);
+    if (rc < 0)
+      return -1;
+  } else {
+    n = flash->size < 16? flash->size: 16;
+    for (i = 0; i < n; i++)
+      if (pgm->read_byte(pgm, p, flash, i, flash->buf + i) != 0)
+        return -1;
+  }
+  memcpy(data, flash->buf, n);
+
+  return n;
+}
+
+/*
+ * Run the target at the given SCK period, and check that repeated
+ * reads of the signature, and a read of the start of flash, agree
+ * with the reference readings.
+ */
+static int avr_sck_check(PROGRAMMER * pgm, AVRPART * p, AVRMEM * sigm,
+                         AVRMEM * flash, double period,
+                         const unsigned char * refsig,
+                         const unsigned char * refdata, int nref)
+{
+  unsigned char sig[sizeof(p->signature)], data[SCK_MAXREAD];
+  int i, ok = 0;
+
+  if (pgm->set_sck_period(pgm, period * 1e-6) == 0) {
+    for (i = 0, ok = 1; ok && i < 3; i++) {
+      if (avr_sck_sample(pgm, p, sigm, i == 0? flash: NULL, sig, data) < 0 ||
+          memcmp(sig, refsig, sigm->size) != 0 ||
+          (i == 0 && flash != NULL && memcmp(data, refdata, nref) != 0))
+        ok = 0;
+    }
+  }
+
+  avrdude_message(MSG_NOTICE, "%s: SCK period %g us: %s\n",
+                  progname, period, ok? "OK": "failed");
+  return ok;
+}
+
+/*
+ * Find the fastest SCK clock the target can be read reliably with.
+ *
+ * If 'hint' (in microseconds) is given, it is tried first, and used
+ * without a search if the signature reads back consistently and
+ * matches the part.  Otherwise, reference readings of signature and
+ * start of flash are taken at the slowest period, and a binary search
+ * over sck_periods looks for the shortest period that reproduces them.
+ *
+ * The period found is left in effect, and returned in *period.
+ * Return 0 on success, or -1 if the search failed.
+ */
+int avr_tune_sck(PROGRAMMER * pgm, AVRPART * p, double hint, double * period)
+{
+  unsigned char refsig[sizeof(p->signature)], refdata[SCK_MAXREAD];
+  AVRMEM * sigm, * flash;
+  int nref, lo, hi, mid;
+
+  sigm = avr_locate_mem(p, "signature");
+  if (pgm->set_sck_period == NULL || sigm == NULL ||
+      sigm->size > (int)sizeof(p->signature))
+    return -1;
+  flash = avr_locate_mem(p, "flash");
+
+  /* the part's own signature serves as reference for a cached period */
+  if (hint > 0) {
+    memcpy(refsig, p->signature, sigm->size);
+    if (avr_sck_check(pgm, p, sigm, NULL, hint, refsig, NULL, 0)) {
+      *period = hint;
+      return 0;
+    }
+  }
+
+  hi = SCK_NPERIODS - 1;
+  if (pgm->set_sck_period(pgm, sck_periods[hi] * 1e-6) != 0 ||
+      (nref = avr_sck_sample(pgm, p, sigm, flash, refsig, refdata)) < 0 ||
+      memcmp(refsig, p->signature, sigm->size) != 0) {
+    avrdude_message(MSG_INFO, "%s: cannot read the device at an SCK period of %g us\n",
+                    progname, sck_periods[hi]);
+    return -1;
+  }
+
+  lo = -1;
+  if (avr_sck_check(pgm, p, sigm, flash, sck_periods[0], refsig, refdata, nref)) {
+    hi = 0;
+  } else {
+    lo = 0;
+    while (hi - lo > 1) {
+      mid = (lo + hi) / 2;
+      if (avr_sck_check(pgm, p, sigm, flash, sck_periods[mid], refsig, refdata, nref))
+        hi = mid;
+      else
+        lo = mid;
+    }
+  }
+
+  /* the last period tried may have been a failing one */
+  *period = sck_periods[hi];
+  if (pgm->set_sck_period(pgm, *period * 1e-6) != 0)
+    return -1;
+
+  return 0;
+}
+
+
 /*
  * read the AVR device's signature bytes
  */
@@ -1067,6 +1436,7 @@ int avr_signature(PROGRAMMER * pgm, AVRPART * p)
 static uint8_t get_fuse_bitmask(AVRMEM * m) {
   uint8_t bitmask_r = 0;
   uint8_t bitmask_w = 0;
+  CMDBIT bit;
   int i;
 
   if (!m || m->size > 1) {
@@ -1076,10 +1446,12 @@ static uint8_t get_fuse_bitmask(AVRMEM * m) {
 
   // For fuses, only compare bytes that are actually written *and* read.
   for (i = 0; i < 32; i++) {
-    if (m->op[AVR_OP_WRITE]->bit[i].type == AVR_CMDBIT_INPUT)
-      bitmask_w |= (1 << m->op[AVR_OP_WRITE]->bit[i].bitno);
-    if (m->op[AVR_OP_READ]->bit[i].type == AVR_CMDBIT_OUTPUT)
-      bitmask_r |= (1 << m->op[AVR_OP_READ]->bit[i].bitno);
+    avr_opcode_bit(m->op[AVR_OP_WRITE], i, &bit);
+    if (bit.type == AVR_CMDBIT_INPUT)
+      bitmask_w |= (1 << bit.bitno);
+    avr_opcode_bit(m->op[AVR_OP_READ], i, &bit);
+    if (bit.type == AVR_CMDBIT_OUTPUT)
+      bitmask_r |= (1 << bit.bitno);
   }
   return bitmask_r & bitmask_w;
 }
@@ -1098,9 +1470,6 @@ int compare_memory_masked(AVRMEM * m, uint8_t b1, uint8_t b2) {
  */
 int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size)
 {
-  int i;
-  unsigned char * buf1, * buf2;
-  int vsize;
   AVRMEM * a, * b;
 
   a = avr_locate_mem(p, memtype);
@@ -1117,31 +1486,99 @@ int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size)
     return -1;
   }
 
-  buf1  = a->buf;
-  buf2  = b->buf;
-  vsize = a->size;
+  return avr_verify_mem(a, b, size);
+}
+
 
-  if (vsize < size) {
+/*
+ * State of a verification of memory a against the cells allocated in
+ * memory b.
+ */
+struct verify_state {
+  AVRMEM     * a, * b;
+  unsigned int size;    /* number of bytes to verify */
+  int          all;     /* continue after a mismatch */
+  unsigned int next;    /* all cells below have been compared */
+  int          nbad;    /* number of mismatching bytes */
+  int          nranges; /* number of mismatching address ranges */
+  unsigned int rstart;  /* current mismatch range [rstart, rend) */
+  unsigned int rend;
+};
+
+static void avr_verify_init(struct verify_state * vs, AVRMEM * a, AVRMEM * b,
+                            int size, int all)
+{
+  if (a->size < size) {
     avrdude_message(MSG_INFO, "%s: WARNING: requested verification for %d bytes\n"
                     "%s%s memory region only contains %d bytes\n"
                     "%sOnly %d bytes will be verified.\n",
                     progname, size,
-                    progbuf, memtype, vsize,
-                    progbuf, vsize);
-    size = vsize;
+                    progbuf, a->desc, a->size,
+                    progbuf, a->size);
+    size = a->size;
   }
 
-  for (i=0; i<size; i++) {
-    if ((b->tags[i] & TAG_ALLOCATED) != 0 &&
-        buf1[i] != buf2[i]) {
-      uint8_t bitmask = get_fuse_bitmask(a);
+  memset(vs, 0, sizeof(*vs));
+  vs->a = a;
+  vs->b = b;
+  vs->size = size;
+  vs->all = all;
+}
+
+static void avr_verify_report_range(struct verify_state * vs)
+{
+  if (vs->nranges > 0)
+    avrdude_message(MSG_INFO, "%s: mismatch at 0x%04x..0x%04x (%u bytes)\n",
+                    progname, vs->rstart, vs->rend - 1, vs->rend - vs->rstart);
+}
+
+/*
+ * Compare the cells in [start, end) allocated in vs->b, skipping
+ * anything compared before.  Mismatches only in the unused bits of
+ * fuses are warned about, but ignored.
+ *
+ * Return 0, or -1 on a mismatch unless all mismatches are wanted.
+ */
+static int avr_verify_range(struct verify_state * vs, unsigned int start,
+                            unsigned int end)
+{
+  unsigned char * buf1 = vs->a->buf, * buf2 = vs->b->buf;
+  char * memtype = vs->a->desc;
+  unsigned int i, lo, hi;
+  uint8_t bitmask;
+  int k;
+
+  if (start < vs->next)
+    start = vs->next;
+  if (end > vs->size)
+    end = vs->size;
+
+  for (k = 0; k < vs->b->n_extents && start < end; k++) {
+    lo = vs->b->extents[k].start > start? vs->b->extents[k].start: start;
+    hi = vs->b->extents[k].end < end? vs->b->extents[k].end: end;
+    for (i = lo; i < hi; i++) {
+      if (buf1[i] == buf2[i])
+        continue;
+      bitmask = get_fuse_bitmask(vs->a);
       if((buf1[i] & bitmask) != (buf2[i] & bitmask)) {
         // Mismatch is not just in unused bits
-        avrdude_message(MSG_INFO, "%s: verification error, first mismatch at byte 0x%04x\n"
-                        "%s0x%02x != 0x%02x\n",
-                        progname, i,
-                        progbuf, buf1[i], buf2[i]);
-        return -1;
+        if (vs->nbad++ == 0)
+          avrdude_message(MSG_INFO, "%s: verification error, first mismatch at byte 0x%04x\n"
+                          "%s0x%02x != 0x%02x\n",
+                          progname, i,
+                          progbuf, buf1[i], buf2[i]);
+        if (!vs->all) {
+          vs->next = i + 1;
+          return -1;
+        }
+        if (vs->nranges > 0 && i == vs->rend) {
+          vs->rend++;
+        } else {
+          avr_verify_report_range(vs);
+          vs->rstart = i;
+          vs->rend = i + 1;
+          vs->nranges++;
+        }
       } else {
         // Mismatch is only in unused bits
         if ((buf1[i] | bitmask) != 0xff) {
@@ -1161,7 +1598,72 @@ int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size)
     }
   }
 
-  return size;
+  if (end > vs->next)
+    vs->next = end;
+
+  return 0;
+}
+
+static void avr_verify_finish(struct verify_state * vs)
+{
+  if (vs->all && vs->nbad > 0) {
+    avr_verify_report_range(vs);
+    avrdude_message(MSG_INFO, "%s: %d mismatching bytes in %d ranges\n",
+                    progname, vs->nbad, vs->nranges);
+  }
+}
+
+
+/*
+ * Verify the contents of memory 'a' against the cells allocated in
+ * 'b', up to 'size' bytes.
+ *
+ * Return the number of bytes verified, or -1 on a mismatch.
+ */
+int avr_verify_mem(AVRMEM * a, AVRMEM * b, int size)
+{
+  struct verify_state vs;
+
+  avr_verify_init(&vs, a, b, size, 0);
+  avr_verify_range(&vs, 0, vs.size);
+
+  return vs.nbad? -1: vs.size;
+}
+
+
+static int avr_verify_cb(AVRMEM * mem, unsigned int addr, unsigned int len,
+                         void * cookie)
+{
+  return avr_verify_range(cookie, addr, addr + len);
+}
+
+/*
+ * Read memory 'mem' of part 'p' from the device, and verify it
+ * against the cells allocated in 'vmem' (up to 'size' bytes) while
+ * reading, page by page.  Unless 'all' is set, reading stops at the
+ * first mismatch; otherwise, all mismatching address ranges are
+ * reported.  The number of mismatching bytes is returned in *nbad.
+ *
+ * Return the number of bytes read as avr_read_mem() does, or < 0 if
+ * reading failed or has been stopped due to a mismatch.
+ */
+int avr_verify_stream(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                      AVRMEM * vmem, int size, int all, int * nbad)
+{
+  struct verify_state vs;
+  int rc;
+
+  avr_verify_init(&vs, mem, vmem, size, all);
+
+  rc = avr_read_mem_cb(pgm, p, mem, vmem, avr_verify_cb, &vs);
+  if (rc >= 0)
+    /* catch anything the read has not reported back */
+    avr_verify_range(&vs, 0, vs.size);
+
+  avr_verify_finish(&vs);
+  *nbad = vs.nbad;
+
+  return rc;
 }
 
 
@@ -50,6 +50,7 @@ struct pdata
   unsigned int buffersize;
   unsigned char test_blockmode;
   unsigned char use_blockmode;
+  unsigned char poll_ready;
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -111,6 +112,20 @@ static int avr910_vfy_cmd_sent(PROGRAMMER * pgm, char * errmsg)
 }
 
 
+/*
+ * Wait for a write or erase to finish.  The universal command needed
+ * to poll RDY/BSY is not implemented by every AVR910 firmware, so this
+ * only polls when requested by -x poll_ready.
+ */
+static void avr910_wait_ready(PROGRAMMER * pgm, AVRPART * p, unsigned int max_us)
+{
+  if (PDATA(pgm)->poll_ready)
+    avr_wait_ready(pgm, p, max_us);
+  else
+    usleep(max_us);
+}
+
+
 /*
  * issue the 'chip erase' command to the AVR device
  */
@@ -123,7 +138,7 @@ static int avr910_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   /*
    * avr910 firmware may not delay long enough
    */
-  usleep (p->chip_erase_delay);
+  avr910_wait_ready(pgm, p, p->chip_erase_delay);
 
   return 0;
 }
@@ -349,6 +364,13 @@ static int avr910_parseextparms(PROGRAMMER * pgm, LISTID extparms)
 
       continue;
     }
+    if (strcmp(extended_param, "poll_ready") == 0) {
+      avrdude_message(MSG_NOTICE2, "%s: avr910_parseextparms(-x): polling RDY/BSY\n",
+                      progname);
+      PDATA(pgm)->poll_ready = 1;
+
+      continue;
+    }
 
     avrdude_message(MSG_INFO, "%s: avr910_parseextparms(): invalid extended parameter '%s'\n",
                     progname, extended_param);
@@ -526,7 +548,7 @@ static int avr910_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       avr910_vfy_cmd_sent(pgm, "flush page");
 
       page_wr_cmd_pending = 0;
-      usleep(m->max_write_delay);
+      avr910_wait_ready(pgm, p, m->max_write_delay);
       avr910_set_addr(pgm, addr>>1);
 
       /* Set page address for next page. */
@@ -546,7 +568,7 @@ static int avr910_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     avr910_set_addr(pgm, page_addr>>1);
     avr910_send(pgm, "m", 1);
     avr910_vfy_cmd_sent(pgm, "flush final page");
-    usleep(m->max_write_delay);
+    avr910_wait_ready(pgm, p, m->max_write_delay);
   }
 
   return addr;
@@ -569,7 +591,7 @@ static int avr910_paged_write_eeprom(PROGRAMMER * pgm, AVRPART * p,
     cmd[1] = m->buf[addr];
     avr910_send(pgm, cmd, sizeof(cmd));
     avr910_vfy_cmd_sent(pgm, "write byte");
-    usleep(m->max_write_delay);
+    avr910_wait_ready(pgm, p, m->max_write_delay);
 
     addr++;
 
@@ -772,4 +794,7 @@ void avr910_initpgm(PROGRAMMER * pgm)
   pgm->parseextparams = avr910_parseextparms;
   pgm->setup          = avr910_setup;
   pgm->teardown       = avr910_teardown;
+
+  /* the bootloader may ignore or only partly do a chip erase */
+  pgm->erase_blanks = 0;
 }
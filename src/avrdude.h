@@ -26,6 +26,8 @@
 #define USER_CONF_FILE "avrdude.rc"
 #else
 #define USER_CONF_FILE ".avrduderc"
+#define USER_CACHE_FILE ".avrdude.cache"
+#define USER_SCK_CACHE_FILE ".avrdude.sck"
 #endif
 
 extern char * progname;		/* name of program, for messages */
@@ -906,7 +906,7 @@ static int avrftdi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 
 	avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
 	pgm->cmd(pgm, cmd, res);
-	usleep(p->chip_erase_delay);
+	avr_wait_ready(pgm, p, p->chip_erase_delay);
 	pgm->initialize(pgm, p);
 
 	return 0;
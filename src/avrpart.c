@@ -20,6 +20,7 @@
 
 /* $Id$ */
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -41,6 +42,7 @@ OPCODE * avr_new_opcode(void)
   }
 
   memset(m, 0, sizeof(*m));
+  m->output_index = -1;
 
   return m;
 }
@@ -70,6 +72,153 @@ void avr_free_opcode(OPCODE * op)
   free(op);
 }
 
+/*
+ * avr_compile_opcode()
+ *
+ * Compile the bit specs of an instruction, as given in the
+ * configuration file, into op.  Bits of the same operand whose
+ * command bit and operand bit numbers differ by the same amount
+ * form one run.
+ */
+int avr_compile_opcode(OPCODE * op, const CMDBIT bits[32])
+{
+  int i, k, r, kind, shift;
+  int nruns = 0;
+
+  memset(op, 0, sizeof(*op));
+  op->output_index = -1;
+
+  for (kind = 0; kind < AVR_OPRUN_MAX; kind++) {
+    for (i = 0; i < 32; i++) {
+      switch (bits[i].type) {
+        case AVR_CMDBIT_IGNORE:
+          continue;
+        case AVR_CMDBIT_VALUE:
+          if (kind == 0) {
+            op->value_mask |= 1U << i;
+            if (bits[i].value)
+              op->value |= 1U << i;
+          }
+          continue;
+        case AVR_CMDBIT_ADDRESS:
+          k = AVR_OPRUN_ADDRESS;
+          if (bits[i].bitno < 0 || bits[i].bitno > 31) {
+            avrdude_message(MSG_INFO, "%s: address bit number %d out of range\n",
+                            progname, bits[i].bitno);
+            return -1;
+          }
+          break;
+        case AVR_CMDBIT_INPUT:
+          k = AVR_OPRUN_INPUT;
+          break;
+        case AVR_CMDBIT_OUTPUT:
+          k = AVR_OPRUN_OUTPUT;
+          if (op->output_index < 0)
+            op->output_index = 3 - i / 8;
+          break;
+        default:
+          avrdude_message(MSG_INFO, "%s: invalid opcode bit type %d\n",
+                          progname, bits[i].type);
+          return -1;
+      }
+      if (k != kind)
+        continue;
+      if (k != AVR_OPRUN_ADDRESS && (bits[i].bitno < 0 || bits[i].bitno > 7)) {
+        avrdude_message(MSG_INFO, "%s: data bit number %d out of range\n",
+                        progname, bits[i].bitno);
+        return -1;
+      }
+
+      shift = i - bits[i].bitno;
+      r = kind > 0? op->run_end[kind - 1]: 0;
+      for (; r < nruns; r++)
+        if (op->run_shift[r] == shift)
+          break;
+      if (r == nruns) {
+        if (nruns == AVR_OP_MAXRUNS) {
+          avrdude_message(MSG_INFO, "%s: too many discontiguous operand bits "
+                          "in instruction\n", progname);
+          return -1;
+        }
+        op->run_shift[nruns++] = shift;
+      }
+      op->run_mask[r] |= 1U << i;
+      op->mask[kind] |= 1U << i;
+    }
+    op->run_end[kind] = nruns;
+  }
+
+  return 0;
+}
+
+
+/*
+ * avr_opcode_bit()
+ *
+ * Recover the bit spec of command bit bitno from the compiled
+ * instruction.
+ */
+void avr_opcode_bit(const OPCODE * op, int bitno, CMDBIT * bit)
+{
+  unsigned int mask = 1U << bitno;
+  int r, kind;
+
+  bit->type  = AVR_CMDBIT_IGNORE;
+  bit->value = 0;
+  bit->bitno = bitno % 8;
+
+  if (op->value_mask & mask) {
+    bit->type  = AVR_CMDBIT_VALUE;
+    bit->value = (op->value & mask) != 0;
+    return;
+  }
+
+  for (kind = 0, r = 0; kind < AVR_OPRUN_MAX; kind++) {
+    for (; r < op->run_end[kind]; r++) {
+      if (op->run_mask[r] & mask) {
+        bit->type  = kind == AVR_OPRUN_ADDRESS? AVR_CMDBIT_ADDRESS:
+                     kind == AVR_OPRUN_INPUT? AVR_CMDBIT_INPUT: AVR_CMDBIT_OUTPUT;
+        bit->bitno = bitno - op->run_shift[r];
+        return;
+      }
+    }
+  }
+}
+
+
+static unsigned int avr_cmd_get(const unsigned char * cmd)
+{
+  return (unsigned int)cmd[0] << 24 | (unsigned int)cmd[1] << 16 |
+         (unsigned int)cmd[2] << 8 | cmd[3];
+}
+
+static void avr_cmd_put(unsigned char * cmd, unsigned int w)
+{
+  cmd[0] = w >> 24;
+  cmd[1] = w >> 16;
+  cmd[2] = w >> 8;
+  cmd[3] = w;
+}
+
+/*
+ * Move the operand bits of val into their command bit positions.
+ */
+static unsigned int avr_op_scatter(OPCODE * op, int kind, unsigned long val)
+{
+  unsigned int w = 0;
+  int r;
+
+  for (r = kind > 0? op->run_end[kind - 1]: 0; r < op->run_end[kind]; r++) {
+    if (op->run_shift[r] >= 0)
+      w |= (unsigned int)(val << op->run_shift[r]) & op->run_mask[r];
+    else
+      w |= (unsigned int)(val >> -op->run_shift[r]) & op->run_mask[r];
+  }
+
+  return w;
+}
+
+
 /*
  * avr_set_bits()
  *
@@ -77,20 +226,7 @@ void avr_free_opcode(OPCODE * op)
  */
 int avr_set_bits(OPCODE * op, unsigned char * cmd)
 {
-  int i, j, bit;
-  unsigned char mask;
-
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_VALUE) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      if (op->bit[i].value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
-    }
-  }
+  avr_cmd_put(cmd, (avr_cmd_get(cmd) & ~op->value_mask) | op->value);
 
   return 0;
 }
@@ -104,22 +240,13 @@ int avr_set_bits(OPCODE * op, unsigned char * cmd)
  */
 int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr)
 {
-  int i, j, bit;
-  unsigned long value;
-  unsigned char mask;
-
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_ADDRESS) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      value = addr >> op->bit[i].bitno & 0x01;
-      if (value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
-    }
-  }
+  unsigned int w;
+
+  if (op->mask[AVR_OPRUN_ADDRESS] == 0)
+    return 0;
+
+  w = avr_cmd_get(cmd) & ~op->mask[AVR_OPRUN_ADDRESS];
+  avr_cmd_put(cmd, w | avr_op_scatter(op, AVR_OPRUN_ADDRESS, addr));
 
   return 0;
 }
@@ -133,22 +260,13 @@ int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr)
  */
 int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data)
 {
-  int i, j, bit;
-  unsigned char value;
-  unsigned char mask;
-
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_INPUT) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      value = data >> op->bit[i].bitno & 0x01;
-      if (value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
-    }
-  }
+  unsigned int w;
+
+  if (op->mask[AVR_OPRUN_INPUT] == 0)
+    return 0;
+
+  w = avr_cmd_get(cmd) & ~op->mask[AVR_OPRUN_INPUT];
+  avr_cmd_put(cmd, w | avr_op_scatter(op, AVR_OPRUN_INPUT, data));
 
   return 0;
 }
@@ -162,22 +280,16 @@ int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data)
  */
 int avr_get_output(OPCODE * op, unsigned char * res, unsigned char * data)
 {
-  int i, j, bit;
-  unsigned char value;
-  unsigned char mask;
-
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_OUTPUT) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      value = ((res[j] & mask) >> bit) & 0x01;
-      value = value << op->bit[i].bitno;
-      if (value)
-        *data = *data | value;
-      else
-        *data = *data & ~value;
-    }
+  unsigned int w, v;
+  int r;
+
+  w = avr_cmd_get(res);
+  for (r = op->run_end[AVR_OPRUN_OUTPUT - 1]; r < op->run_end[AVR_OPRUN_OUTPUT]; r++) {
+    v = w & op->run_mask[r];
+    if (op->run_shift[r] >= 0)
+      *data |= v >> op->run_shift[r];
+    else
+      *data |= v << -op->run_shift[r];
   }
 
   return 0;
@@ -192,16 +304,7 @@ int avr_get_output(OPCODE * op, unsigned char * res, unsigned char * data)
  */
 int avr_get_output_index(OPCODE * op)
 {
-  int i, j;
-
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_OUTPUT) {
-      j = 3 - i / 8;
-      return j;
-    }
-  }
-
-  return -1;
+  return op->output_index;
 }
 
 
@@ -220,6 +323,7 @@ static char * avr_op_str(int op)
     case AVR_OP_WRITEPAGE   : return "WRITEPAGE"; break;
     case AVR_OP_CHIP_ERASE  : return "CHIP_ERASE"; break;
     case AVR_OP_PGM_ENABLE  : return "PGM_ENABLE"; break;
+    case AVR_OP_POLL_READY  : return "POLL_READY"; break;
     default : return "<unknown opcode>"; break;
   }
 }
@@ -277,12 +381,7 @@ int avr_initmem(AVRPART * p)
               progname, m->desc, m->size);
       return -1;
     }
-    m->tags = (unsigned char *) malloc(m->size);
-    if (m->tags == NULL) {
-      avrdude_message(MSG_INFO, "%s: can't alloc buffer for %s size of %d bytes\n",
-              progname, m->desc, m->size);
-      return -1;
-    }
+    avr_mem_untag_all(m);
   }
 
   return 0;
@@ -308,14 +407,14 @@ AVRMEM * avr_dup_mem(AVRMEM * m)
     memcpy(n->buf, m->buf, n->size);
   }
 
-  if (m->tags != NULL) {
-    n->tags = (unsigned char *)malloc(n->size);
-    if (n->tags == NULL) {
-      avrdude_message(MSG_INFO, "avr_dup_mem(): out of memory (memsize=%d)\n",
-                      n->size);
+  if (m->extents != NULL) {
+    n->extents = (AVRMEM_EXTENT *)malloc(n->max_extents * sizeof(AVRMEM_EXTENT));
+    if (n->extents == NULL) {
+      avrdude_message(MSG_INFO, "avr_dup_mem(): out of memory (extents=%d)\n",
+                      n->max_extents);
       exit(1);
     }
-    memcpy(n->tags, m->tags, n->size);
+    memcpy(n->extents, m->extents, n->n_extents * sizeof(AVRMEM_EXTENT));
   }
 
   for (i = 0; i < AVR_OP_MAX; i++) {
@@ -332,9 +431,9 @@ void avr_free_mem(AVRMEM * m)
       free(m->buf);
       m->buf = NULL;
     }
-    if (m->tags != NULL) {
-      free(m->tags);
-      m->tags = NULL;
+    if (m->extents != NULL) {
+      free(m->extents);
+      m->extents = NULL;
     }
     for(i=0;i<sizeof(m->op)/sizeof(m->op[0]);i++)
     {
@@ -347,28 +446,218 @@ void avr_free_mem(AVRMEM * m)
     free(m);
 }
 
-AVRMEM * avr_locate_mem(AVRPART * p, char * desc)
+/*
+ * Return the index of the first extent of m that ends at or after
+ * addr, or m->n_extents if there is none.
+ */
+static int avr_mem_extent_find(AVRMEM * m, unsigned int addr)
 {
-  AVRMEM * m, * match;
-  LNODEID ln;
-  int matches;
-  int l;
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = m->n_extents;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (m->extents[mid].end < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-  l = strlen(desc);
-  matches = 0;
-  match = NULL;
-  for (ln=lfirst(p->mem); ln; ln=lnext(ln)) {
-    m = ldata(ln);
-    if (strncmp(desc, m->desc, l) == 0) {
-      match = m;
-      matches++;
+  return lo;
+}
+
+/*
+ * Mark the len bytes starting at addr as allocated, merging with any
+ * overlapping or adjacent extents.
+ */
+void avr_mem_tag(AVRMEM * m, unsigned int addr, unsigned int len)
+{
+  AVRMEM_EXTENT * e;
+  unsigned int end = addr + len;
+  int lo, hi;
+
+  if (len == 0)
+    return;
+
+  /* file loaders mostly proceed upwards, extend the last extent */
+  if (m->n_extents > 0) {
+    e = &m->extents[m->n_extents - 1];
+    if (addr >= e->start && addr <= e->end) {
+      if (end > e->end)
+        e->end = end;
+      return;
     }
   }
 
-  if (matches == 1)
-    return match;
+  lo = avr_mem_extent_find(m, addr);
+  for (hi = lo; hi < m->n_extents && m->extents[hi].start <= end; hi++)
+    ;
+
+  if (lo < hi) {
+    /* merge extents lo ... hi - 1 into lo */
+    e = &m->extents[lo];
+    if (addr < e->start)
+      e->start = addr;
+    e->end = m->extents[hi - 1].end;
+    if (end > e->end)
+      e->end = end;
+    memmove(&m->extents[lo + 1], &m->extents[hi],
+            (m->n_extents - hi) * sizeof(AVRMEM_EXTENT));
+    m->n_extents -= hi - lo - 1;
+    return;
+  }
 
-  return NULL;
+  if (m->n_extents == m->max_extents) {
+    m->max_extents = m->max_extents? 2 * m->max_extents: 16;
+    m->extents = (AVRMEM_EXTENT *)realloc(m->extents,
+                                          m->max_extents * sizeof(AVRMEM_EXTENT));
+    if (m->extents == NULL) {
+      avrdude_message(MSG_INFO, "avr_mem_tag(): out of memory (extents=%d)\n",
+                      m->max_extents);
+      exit(1);
+    }
+  }
+
+  memmove(&m->extents[lo + 1], &m->extents[lo],
+          (m->n_extents - lo) * sizeof(AVRMEM_EXTENT));
+  m->extents[lo].start = addr;
+  m->extents[lo].end = end;
+  m->n_extents++;
+}
+
+/*
+ * Mark all bytes of m as unallocated.
+ */
+void avr_mem_untag_all(AVRMEM * m)
+{
+  m->n_extents = 0;
+}
+
+/*
+ * Return non-zero if any of the len bytes starting at addr is
+ * allocated.
+ */
+int avr_mem_tagged(AVRMEM * m, unsigned int addr, unsigned int len)
+{
+  int i;
+
+  /* first extent ending after addr */
+  i = avr_mem_extent_find(m, addr + 1);
+
+  return i < m->n_extents && m->extents[i].start < addr + len;
+}
+
+
+/*
+ * Return the data slot for key in the lookup index h.  Running out of
+ * memory here is treated like anywhere else in this file.
+ */
+static void ** avr_index_slot(HASHID h, const void * key, size_t keylen)
+{
+  void ** slot;
+
+  slot = hslot(h, key, keylen);
+  if (slot == NULL) {
+    avrdude_message(MSG_INFO, "avr_index_slot(): out of memory\n");
+    exit(1);
+  }
+
+  return slot;
+}
+
+static HASHID avr_index_new(void)
+{
+  HASHID h;
+
+  h = hcreat();
+  if (h == NULL) {
+    avrdude_message(MSG_INFO, "avr_index_new(): out of memory\n");
+    exit(1);
+  }
+
+  return h;
+}
+
+
+/* marks a memory name prefix that is shared by several memories */
+static char mem_ambiguous;
+
+static void avr_mem_index_add(HASHID h, AVRMEM * m)
+{
+  void ** slot;
+  size_t l, len;
+
+  len = strlen(m->desc);
+  for (l = 0; l <= len; l++) {
+    slot = avr_index_slot(h, m->desc, l);
+    if (*slot == NULL)
+      *slot = m;
+    else if (*slot != m)
+      *slot = &mem_ambiguous;
+  }
+}
+
+/*
+ * Return the memory index of part p, bringing it up to date with the
+ * memory list first.  The index maps every prefix of every memory
+ * name (including the empty one and the full name) to that memory,
+ * or to &mem_ambiguous if more than one memory starts with it.
+ * Memories added at either end of the list since the last call are
+ * just added; any other change rebuilds the index.
+ */
+static HASHID avr_mem_index(AVRPART * p)
+{
+  LNODEID ln;
+
+  if (p->memidx == NULL || p->memidx_gen != lgen(p->mem)) {
+    hdestroy(p->memidx);
+    p->memidx = avr_index_new();
+    p->memidx_gen = lgen(p->mem);
+    p->memidx_first = p->memidx_last = NULL;
+  }
+
+  if (p->memidx_first == NULL) {
+    for (ln=lfirst(p->mem); ln; ln=lnext(ln))
+      avr_mem_index_add(p->memidx, ldata(ln));
+  } else {
+    for (ln=lprev(p->memidx_first); ln; ln=lprev(ln))
+      avr_mem_index_add(p->memidx, ldata(ln));
+    for (ln=lnext(p->memidx_last); ln; ln=lnext(ln))
+      avr_mem_index_add(p->memidx, ldata(ln));
+  }
+  p->memidx_first = lfirst(p->mem);
+  p->memidx_last = llast(p->mem);
+
+  return p->memidx;
+}
+
+/*
+ * Locate the memory of part p whose name starts with desc.  The
+ * match must be unique, so any unambiguous abbreviation works.
+ */
+AVRMEM * avr_locate_mem(AVRPART * p, char * desc)
+{
+  AVRMEM * m;
+
+  m = hget(avr_mem_index(p), desc, strlen(desc));
+  if (m == (AVRMEM *)&mem_ambiguous)
+    return NULL;
+
+  return m;
+}
+
+
+/*
+ * Tell whether m is the flash, or one of the Xmega flash sections.
+ * These are the memories a chip erase leaves reading as all 0xff.
+ */
+int avr_mem_is_flash_type(AVRMEM * m)
+{
+  return strcasecmp(m->desc, "flash") == 0 ||
+         strcasecmp(m->desc, "application") == 0 ||
+         strcasecmp(m->desc, "apptable") == 0 ||
+         strcasecmp(m->desc, "boot") == 0;
 }
 
 
@@ -377,6 +666,7 @@ void avr_mem_display(const char * prefix, FILE * f, AVRMEM * m, int type,
 {
   int i, j;
   char * optr;
+  CMDBIT bit;
 
   if (m == NULL) {
       fprintf(f,
@@ -416,12 +706,13 @@ void avr_mem_display(const char * prefix, FILE * f, AVRMEM * m, int type,
               optr = avr_op_str(i);
             else
               optr = " ";
+          avr_opcode_bit(m->op[i], j, &bit);
           fprintf(f,
                   "%s    %-11s  %8d  %8s  %5d  %5d\n",
                   prefix, optr, j,
-                  bittype(m->op[i]->bit[j].type),
-                  m->op[i]->bit[j].bitno,
-                  m->op[i]->bit[j].value);
+                  bittype(bit.type),
+                  bit.bitno,
+                  bit.value);
           }
         }
       }
@@ -478,6 +769,8 @@ AVRPART * avr_dup_part(AVRPART * d)
   *p = *d;
 
   p->mem = save;
+  p->memidx = NULL;
+  p->memidx_first = p->memidx_last = NULL;
 
   for (ln=lfirst(d->mem); ln; ln=lnext(ln)) {
     ladd(p->mem, avr_dup_mem(ldata(ln)));
@@ -495,6 +788,8 @@ void avr_free_part(AVRPART * d)
 int i;
 	ldestroy_cb(d->mem, (void(*)(void *))avr_free_mem);
 	d->mem = NULL;
+	hdestroy(d->memidx);
+	d->memidx = NULL;
     for(i=0;i<sizeof(d->op)/sizeof(d->op[0]);i++)
     {
     	if (d->op[i] != NULL)
@@ -506,60 +801,130 @@ int i;
 	free(d);
 }
 
-AVRPART * locate_part(LISTID parts, char * partdesc)
-{
-  LNODEID ln1;
-  AVRPART * p = NULL;
-  int found;
+/*
+ * Lookup indexes for the part list searched last.  Parts added at
+ * either end of the list are added to them as they show up; they are
+ * rebuilt whenever a different list is searched, or the list has
+ * changed otherwise.  Each index maps its key to the first part in
+ * list order carrying that key, just like a linear search would find
+ * it.
+ */
+static struct {
+  LISTID        list;
+  unsigned long gen;
+  LNODEID       first;   /* first and last part indexed */
+  LNODEID       last;
+  HASHID        name;    /* lower case id and desc */
+  HASHID        sig;     /* 3 signature bytes */
+  HASHID        devcode; /* avr910 device code */
+} part_index;
 
-  found = 0;
+/*
+ * Copy s into buf in lower case, for case-insensitive lookups.
+ * Returns the length, or -1 if s does not fit.
+ */
+static int avr_lower_key(char * buf, size_t size, const char * s)
+{
+  size_t i;
 
-  for (ln1=lfirst(parts); ln1 && !found; ln1=lnext(ln1)) {
-    p = ldata(ln1);
-    if ((strcasecmp(partdesc, p->id) == 0) ||
-        (strcasecmp(partdesc, p->desc) == 0))
-      found = 1;
+  for (i = 0; s[i]; i++) {
+    if (i + 1 >= size)
+      return -1;
+    buf[i] = tolower((unsigned char)s[i]);
   }
+  buf[i] = 0;
 
-  if (found)
-    return p;
+  return i;
+}
+
+/*
+ * Enter p under key.  A part that comes earlier in the list than the
+ * one already there replaces it (override), a later one does not.
+ */
+static void avr_index_add(HASHID h, const void * key, size_t keylen,
+                          AVRPART * p, int override)
+{
+  void ** slot;
 
-  return NULL;
+  slot = avr_index_slot(h, key, keylen);
+  if (*slot == NULL || override)
+    *slot = p;
 }
 
-AVRPART * locate_part_by_avr910_devcode(LISTID parts, int devcode)
+static void avr_part_index_add(AVRPART * p, int override)
+{
+  char key[AVR_DESCLEN];
+  int l;
+
+  if ((l = avr_lower_key(key, sizeof(key), p->id)) >= 0)
+    avr_index_add(part_index.name, key, l, p, override);
+  if ((l = avr_lower_key(key, sizeof(key), p->desc)) >= 0)
+    avr_index_add(part_index.name, key, l, p, override);
+  avr_index_add(part_index.sig, p->signature, 3, p, override);
+  avr_index_add(part_index.devcode, &p->avr910_devcode,
+                sizeof(p->avr910_devcode), p, override);
+}
+
+static void avr_part_index(LISTID parts)
 {
   LNODEID ln1;
-  AVRPART * p = NULL;
 
-  for (ln1=lfirst(parts); ln1; ln1=lnext(ln1)) {
-    p = ldata(ln1);
-    if (p->avr910_devcode == devcode)
-      return p;
+  if (part_index.list != parts || part_index.gen != lgen(parts)) {
+    hdestroy(part_index.name);
+    hdestroy(part_index.sig);
+    hdestroy(part_index.devcode);
+    part_index.name = avr_index_new();
+    part_index.sig = avr_index_new();
+    part_index.devcode = avr_index_new();
+    part_index.list = parts;
+    part_index.gen = lgen(parts);
+    part_index.first = part_index.last = NULL;
   }
 
-  return NULL;
+  if (part_index.first == NULL) {
+    for (ln1=lfirst(parts); ln1; ln1=lnext(ln1))
+      avr_part_index_add(ldata(ln1), 0);
+  } else {
+    /* parts pushed in front of the indexed ones take precedence */
+    for (ln1=lprev(part_index.first); ln1; ln1=lprev(ln1))
+      avr_part_index_add(ldata(ln1), 1);
+    for (ln1=lnext(part_index.last); ln1; ln1=lnext(ln1))
+      avr_part_index_add(ldata(ln1), 0);
+  }
+  part_index.first = lfirst(parts);
+  part_index.last = llast(parts);
+}
+
+AVRPART * locate_part(LISTID parts, char * partdesc)
+{
+  char key[AVR_DESCLEN];
+  int l;
+
+  l = avr_lower_key(key, sizeof(key), partdesc);
+  if (l < 0)
+    return NULL;
+
+  avr_part_index(parts);
+
+  return hget(part_index.name, key, l);
+}
+
+AVRPART * locate_part_by_avr910_devcode(LISTID parts, int devcode)
+{
+  avr_part_index(parts);
+
+  return hget(part_index.devcode, &devcode, sizeof(devcode));
 }
 
 AVRPART * locate_part_by_signature(LISTID parts, unsigned char * sig,
                                    int sigsize)
 {
-  LNODEID ln1;
-  AVRPART * p = NULL;
-  int i;
+  if (sigsize != 3)
+    return NULL;
 
-  if (sigsize == 3) {
-    for (ln1=lfirst(parts); ln1; ln1=lnext(ln1)) {
-      p = ldata(ln1);
-      for (i=0; i<3; i++)
-        if (p->signature[i] != sig[i])
-          break;
-      if (i == 3)
-        return p;
-    }
-  }
+  avr_part_index(parts);
 
-  return NULL;
+  return hget(part_index.sig, sig, 3);
 }
 
 /*
@@ -0,0 +1,1054 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2022 The AVRDUDE authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Bootloader emulator for benchmarking the serial programmers.
+ *
+ * Opens a pseudo terminal, prints the name of its slave side on
+ * stdout, and answers on it like a target running an STK500v1
+ * (optiboot), AVR109 or AVR910 bootloader, or like the UPDI of a
+ * tinyAVR/megaAVR 0-series part (NVM controller version 0).  avrdude
+ * is then pointed at the slave with -P.
+ *
+ * The target memories live in host memory.  The flash starts out
+ * holding an old image rather than blank, so pages left over by a
+ * missing erase show up when the flash is read back.  Like optiboot,
+ * the STK500v1 emulation ignores the chip erase instruction.
+ *
+ * The wire can be given a baud rate and a turnaround latency (e.g.
+ * the latency timer of a USB serial adapter): replies are held back
+ * by the time it takes to move the bytes exchanged since the previous
+ * reply, plus the latency.  Replies to several requests that arrive
+ * back to back go out together, as they would through a real adapter,
+ * so pipelining in the host protocol code pays off here as well.
+ *
+ * The emulator runs until it is killed.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "stk500_private.h"
+#include "updi_constants.h"
+
+enum protocol {
+  PROTO_STK500V1,
+  PROTO_AVR109,
+  PROTO_AVR910,
+  PROTO_UPDI
+};
+
+static const char * progname = "bootemu";
+
+static enum protocol proto = PROTO_STK500V1;
+static int verbose;
+
+static int mfd = -1;                    /* pty master */
+
+static unsigned char ibuf[4096];
+static int ilen, ipos;
+static unsigned char obuf[65536];
+static int olen;
+static long baud;                       /* 0: no wire time */
+static long latency_us;
+static long wire_bytes;                 /* exchanged since the last reply */
+
+/* target memories for the bootloader protocols */
+static unsigned char * flash;
+static unsigned char * eeprom;
+static unsigned int flash_size = 32768;
+static unsigned int eeprom_size = 1024;
+static unsigned int page_size = 128;
+static unsigned char sig[3] = { 0x1e, 0x95, 0x0f };
+static unsigned char devcode = 0x76;   /* AVR910 device code (ATmega8) */
+static unsigned char lfuse = 0xff, hfuse = 0xde, efuse = 0xfd, lock = 0xff;
+static unsigned long addr;              /* current address */
+static unsigned char ext_addr;          /* STK500v1 extended address byte */
+
+/* UPDI: the 16-bit data space of the part */
+#define DS_SIZE      0x10000
+#define NVMCTRL_BASE 0x1000
+#define SIGROW_BASE  0x1100
+#define FUSES_BASE   0x1280
+#define USERROW_BASE 0x1300
+#define EEPROM_BASE  0x1400
+
+static unsigned char ds[DS_SIZE];
+static unsigned char pb[DS_SIZE];       /* NVM page buffer */
+static unsigned char pbm[DS_SIZE];      /* page buffer bytes loaded */
+static unsigned int pb_lo = DS_SIZE, pb_hi;
+static unsigned int flash_offset = 0x8000;
+static unsigned char nvm_regs[16];
+static unsigned char cs[16];
+static unsigned int repeat;
+static unsigned long ptr;
+static int rsd;                         /* response signature disabled */
+static int nvmprog, in_reset, locked;
+static unsigned char key_status;
+
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "Options:\n"
+          "  -p <protocol>   stk500v1, avr109, avr910 or updi [stk500v1]\n"
+          "  -f <size>       flash size in bytes [32768]\n"
+          "  -e <size>       EEPROM size in bytes [1024]\n"
+          "  -g <size>       flash page size, AVR109 buffer size [128]\n"
+          "  -s <signature>  signature bytes as 6 hex digits [1e950f]\n"
+          "  -d <code>       AVR910/AVR109 device code [0x76]\n"
+          "  -o <offset>     UPDI: flash offset in the data space [0x8000]\n"
+          "  -b <baud>       account for the wire time at this baud rate\n"
+          "  -l <us>         turnaround latency in microseconds\n"
+          "  -v              trace commands on stderr\n",
+          progname);
+}
+
+
+static void wire_delay(int nbytes)
+{
+  long us = latency_us;
+
+  if (baud > 0)
+    us += (long)((double)(wire_bytes + nbytes) * 10 * 1e6 / baud);
+  if (us > 0)
+    usleep(us);
+  wire_bytes = 0;
+}
+
+
+static void flush_out(void)
+{
+  int n, off = 0;
+
+  if (olen == 0)
+    return;
+
+  wire_delay(olen);
+  while (off < olen) {
+    n = write(mfd, obuf + off, olen - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "%s: write: %s\n", progname, strerror(errno));
+      exit(1);
+    }
+    off += n;
+  }
+  olen = 0;
+}
+
+
+static void putb(unsigned char c)
+{
+  if (olen == sizeof(obuf))
+    flush_out();
+  obuf[olen++] = c;
+}
+
+
+static void putn(const unsigned char * s, int n)
+{
+  while (n-- > 0)
+    putb(*s++);
+}
+
+
+/*
+ * Next byte from the host.  When everything that has arrived has been
+ * consumed, the host is waiting for us, so the replies collected so
+ * far go out before blocking.
+ */
+static unsigned char getb(void)
+{
+  unsigned char c;
+
+  while (ipos == ilen) {
+    flush_out();
+    ilen = read(mfd, ibuf, sizeof(ibuf));
+    ipos = 0;
+    if (ilen < 0 && errno == EINTR) {
+      ilen = 0;
+      continue;
+    }
+    if (ilen <= 0) {
+      fprintf(stderr, "%s: read: %s\n", progname,
+              ilen < 0? strerror(errno): "end of file");
+      exit(1);
+    }
+    wire_bytes += ilen;
+  }
+  c = ibuf[ipos++];
+
+  /* the UPDI line is half duplex, the host reads back what it sent */
+  if (proto == PROTO_UPDI)
+    putb(c);
+
+  return c;
+}
+
+
+static void trace(const char * fmt, ...)
+{
+  va_list ap;
+
+  if (!verbose)
+    return;
+  va_start(ap, fmt);
+  fprintf(stderr, "%s: ", progname);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+
+static void chip_erase(void)
+{
+  memset(flash, 0xff, flash_size);
+  memset(eeprom, 0xff, eeprom_size);
+  lock = 0xff;
+}
+
+
+static unsigned char flash_rd(unsigned long a)
+{
+  return a < flash_size? flash[a]: 0xff;
+}
+
+
+static void flash_wr(unsigned long a, unsigned char v)
+{
+  if (a < flash_size)
+    flash[a] = v;
+}
+
+
+static unsigned char eeprom_rd(unsigned long a)
+{
+  return a < eeprom_size? eeprom[a]: 0xff;
+}
+
+
+static void eeprom_wr(unsigned long a, unsigned char v)
+{
+  if (a < eeprom_size)
+    eeprom[a] = v;
+}
+
+
+/*
+ * ISP instruction as passed through by the universal commands of
+ * STK500v1 and AVR910; returns the fourth byte of the answer.
+ */
+static unsigned char isp_cmd(const unsigned char * c)
+{
+  unsigned long wa = ((unsigned long)ext_addr << 16) | (c[1] << 8) | c[2];
+
+  switch (c[0]) {
+    case 0xac:
+      if ((c[1] & 0xe0) == 0xe0)
+        lock = c[3] | 0xc0;
+      else if (c[1] == 0x80)
+        chip_erase();
+      else if (c[1] == 0xa0)
+        lfuse = c[3];
+      else if (c[1] == 0xa8)
+        hfuse = c[3];
+      else if (c[1] == 0xa4)
+        efuse = c[3];
+      return 0;
+    case 0x30: return sig[c[2] & 0x03];
+    case 0x50: return c[1] & 0x08? efuse: lfuse;
+    case 0x58: return c[1] & 0x08? hfuse: lock;
+    case 0x20: return flash_rd(wa * 2);
+    case 0x28: return flash_rd(wa * 2 + 1);
+    case 0xa0: return eeprom_rd((c[1] << 8) | c[2]);
+    case 0xc0: eeprom_wr((c[1] << 8) | c[2], c[3]); return 0;
+    case 0x4d: ext_addr = c[2]; return 0;
+  }
+  return 0;
+}
+
+
+/*
+ * STK500v1, the subset optiboot implements plus the parameter and
+ * device commands avrdude sends while initializing.
+ */
+static int stk_eop(void)
+{
+  if (getb() == Sync_CRC_EOP) {
+    putb(Resp_STK_INSYNC);
+    return 1;
+  }
+  putb(Resp_STK_NOSYNC);
+  return 0;
+}
+
+
+static void stk500v1_cmd(void)
+{
+  unsigned char c[32];
+  unsigned int n, i;
+  unsigned long a;
+
+  c[0] = getb();
+  switch (c[0]) {
+    case Cmnd_STK_GET_SYNC:
+    case Cmnd_STK_ENTER_PROGMODE:
+    case Cmnd_STK_LEAVE_PROGMODE:
+      if (stk_eop())
+        putb(Resp_STK_OK);
+      break;
+
+    case Cmnd_STK_GET_SIGN_ON:
+      if (stk_eop()) {
+        putn((const unsigned char *)STK_SIGN_ON_MESSAGE, strlen(STK_SIGN_ON_MESSAGE));
+        putb(Resp_STK_OK);
+      }
+      break;
+
+    case Cmnd_STK_GET_PARAMETER:
+      c[1] = getb();
+      if (stk_eop()) {
+        switch (c[1]) {
+          case Parm_STK_HW_VER: putb(2); break;
+          case Parm_STK_SW_MAJOR: putb(4); break;
+          case Parm_STK_SW_MINOR: putb(4); break;
+          default: putb(3); break;
+        }
+        putb(Resp_STK_OK);
+      }
+      break;
+
+    case Cmnd_STK_SET_PARAMETER:
+      c[1] = getb();
+      c[2] = getb();
+      if (stk_eop())
+        putb(Resp_STK_OK);
+      break;
+
+    case Cmnd_STK_SET_DEVICE:
+      for (i = 0; i < 20; i++)
+        (void)getb();
+      if (stk_eop())
+        putb(Resp_STK_OK);
+      break;
+
+    case Cmnd_STK_SET_DEVICE_EXT:
+      /* the first argument counts itself */
+      n = getb();
+      for (i = 1; i < n; i++)
+        (void)getb();
+      if (stk_eop())
+        putb(Resp_STK_OK);
+      break;
+
+    case Cmnd_STK_LOAD_ADDRESS:
+      c[1] = getb();
+      c[2] = getb();
+      if (stk_eop()) {
+        addr = ((unsigned long)ext_addr << 16) | (c[2] << 8) | c[1];
+        putb(Resp_STK_OK);
+      }
+      break;
+
+    case Cmnd_STK_UNIVERSAL:
+      for (i = 0; i < 4; i++)
+        c[i] = getb();
+      if (stk_eop()) {
+        /* optiboot does not erase, the page writes do */
+        if (c[0] == 0xac && c[1] == 0x80)
+          putb(0);
+        else
+          putb(isp_cmd(c));
+        putb(Resp_STK_OK);
+      }
+      break;
+
+    case Cmnd_STK_PROG_PAGE:
+      n = getb() << 8;
+      n |= getb();
+      c[1] = getb();
+      trace("prog page %c 0x%05lx %u", c[1], addr, n);
+      a = c[1] == 'F'? addr * 2: addr;
+      for (i = 0; i < n; i++) {
+        if (c[1] == 'F')
+          flash_wr(a + i, getb());
+        else
+          eeprom_wr(a + i, getb());
+      }
+      if (stk_eop())
+        putb(Resp_STK_OK);
+      break;
+
+    case Cmnd_STK_READ_PAGE:
+      n = getb() << 8;
+      n |= getb();
+      c[1] = getb();
+      trace("read page %c 0x%05lx %u", c[1], addr, n);
+      if (stk_eop()) {
+        a = c[1] == 'F'? addr * 2: addr;
+        for (i = 0; i < n; i++)
+          putb(c[1] == 'F'? flash_rd(a + i): eeprom_rd(a + i));
+        putb(Resp_STK_OK);
+      }
+      break;
+
+    case Cmnd_STK_READ_SIGN:
+      if (stk_eop()) {
+        putn(sig, 3);
+        putb(Resp_STK_OK);
+      }
+      break;
+
+    case Sync_CRC_EOP:
+      /* stray EOP, e.g. the tail of a command we lost sync in */
+      putb(Resp_STK_NOSYNC);
+      break;
+
+    default:
+      trace("unknown command 0x%02x", c[0]);
+      if (getb() == Sync_CRC_EOP)
+        putb(Resp_STK_UNKNOWN);
+      else
+        putb(Resp_STK_NOSYNC);
+      break;
+  }
+}
+
+
+/*
+ * AVR109 (butterfly) and AVR910; the latter has no block mode, so
+ * flash goes through the byte-wise commands.
+ */
+static void avr109_cmd(void)
+{
+  unsigned char c[4];
+  unsigned int n, i;
+  unsigned int bufsize = page_size;
+  int avr910 = proto == PROTO_AVR910;
+
+  c[0] = getb();
+  switch (c[0]) {
+    case 0x1b:
+      /* ESC, resynchronization */
+      break;
+
+    case 'S':
+      putn((const unsigned char *)(avr910? "AVR ISP": "AVRBOOT"), 7);
+      break;
+
+    case 'V':
+      putn((const unsigned char *)"10", 2);
+      break;
+
+    case 'v':
+      putn((const unsigned char *)"10", 2);
+      break;
+
+    case 'p':
+      putb('S');
+      break;
+
+    case 'a':
+      putb('Y');
+      break;
+
+    case 'b':
+      if (avr910) {
+        putb('N');
+      } else {
+        putb('Y');
+        putb((bufsize >> 8) & 0xff);
+        putb(bufsize & 0xff);
+      }
+      break;
+
+    case 't':
+      putb(devcode);
+      putb(0);
+      break;
+
+    case 'T':
+    case 'l':
+    case 'x':
+    case 'y':
+      c[1] = getb();
+      if (c[0] == 'l')
+        lock = c[1] | 0xc0;
+      putb('\r');
+      break;
+
+    case 'P':
+    case 'L':
+    case 'E':
+    case 'm':
+      putb('\r');
+      break;
+
+    case 'e':
+      chip_erase();
+      putb('\r');
+      break;
+
+    case 'A':
+      c[1] = getb();
+      c[2] = getb();
+      addr = (c[1] << 8) | c[2];
+      putb('\r');
+      break;
+
+    case 'H':
+      c[1] = getb();
+      c[2] = getb();
+      c[3] = getb();
+      addr = ((unsigned long)c[1] << 16) | (c[2] << 8) | c[3];
+      putb('\r');
+      break;
+
+    case 'B':
+      n = getb() << 8;
+      n |= getb();
+      c[3] = getb();
+      trace("write block %c 0x%05lx %u", c[3], addr, n);
+      for (i = 0; i < n; i++) {
+        if (c[3] == 'F')
+          flash_wr(addr * 2 + i, getb());
+        else
+          eeprom_wr(addr + i, getb());
+      }
+      addr += c[3] == 'F'? n / 2: n;
+      putb('\r');
+      break;
+
+    case 'g':
+      n = getb() << 8;
+      n |= getb();
+      c[3] = getb();
+      trace("read block %c 0x%05lx %u", c[3], addr, n);
+      for (i = 0; i < n; i++)
+        putb(c[3] == 'F'? flash_rd(addr * 2 + i): eeprom_rd(addr + i));
+      addr += c[3] == 'F'? n / 2: n;
+      break;
+
+    case 'c':
+      flash_wr(addr * 2, getb());
+      putb('\r');
+      break;
+
+    case 'C':
+      flash_wr(addr * 2 + 1, getb());
+      addr++;
+      putb('\r');
+      break;
+
+    case 'R':
+      putb(flash_rd(addr * 2 + 1));
+      putb(flash_rd(addr * 2));
+      addr++;
+      break;
+
+    case 'd':
+      putb(eeprom_rd(addr++));
+      break;
+
+    case 'D':
+      eeprom_wr(addr++, getb());
+      putb('\r');
+      break;
+
+    case 's':
+      putb(sig[2]);
+      putb(sig[1]);
+      putb(sig[0]);
+      break;
+
+    case 'F': putb(lfuse); break;
+    case 'N': putb(hfuse); break;
+    case 'Q': putb(efuse); break;
+    case 'r': putb(lock); break;
+
+    case '.':
+    case ':':
+      n = c[0] == '.'? 4: 3;
+      for (i = 0; i < n; i++)
+        c[i] = getb();
+      if (n == 3)
+        c[3] = 0;
+      putb(isp_cmd(c));
+      putb('\r');
+      break;
+
+    default:
+      trace("unknown command 0x%02x", c[0]);
+      putb('?');
+      break;
+  }
+}
+
+
+/*
+ * UPDI with an NVM controller version 0 (tinyAVR, megaAVR 0-series),
+ * 16-bit addressing.  Stores to the mapped NVM collect in the page
+ * buffer until an NVMCTRL command commits them.
+ */
+static int ds_is_flash(unsigned int a)
+{
+  return a >= flash_offset && a - flash_offset < flash_size;
+}
+
+
+static int ds_is_nvm(unsigned int a)
+{
+  return ds_is_flash(a) ||
+         (a >= USERROW_BASE && a < EEPROM_BASE) ||
+         (a >= EEPROM_BASE && a - EEPROM_BASE < eeprom_size);
+}
+
+
+static void nvm_erase_range(unsigned int lo, unsigned int hi)
+{
+  unsigned int a;
+
+  for (a = lo; a < hi; a++)
+    if (ds_is_nvm(a))
+      ds[a] = 0xff;
+}
+
+
+static void nvm_command(unsigned char cmd)
+{
+  unsigned int a, pg;
+
+  trace("NVMCTRL command %u, page buffer 0x%04x..0x%04x", cmd, pb_lo, pb_hi);
+  switch (cmd) {
+    case UPDI_V0_NVMCTRL_CTRLA_ERASE_PAGE:
+    case UPDI_V0_NVMCTRL_CTRLA_ERASE_WRITE_PAGE:
+      /* flash erases whole pages, EEPROM and user row only what was loaded */
+      for (a = pb_lo; a < pb_hi; a++) {
+        if (!pbm[a])
+          continue;
+        if (ds_is_flash(a)) {
+          pg = a - (a - flash_offset) % page_size;
+          nvm_erase_range(pg, pg + page_size);
+        } else {
+          ds[a] = 0xff;
+        }
+      }
+      if (cmd == UPDI_V0_NVMCTRL_CTRLA_ERASE_PAGE)
+        break;
+      /* FALLTHROUGH */
+    case UPDI_V0_NVMCTRL_CTRLA_WRITE_PAGE:
+      for (a = pb_lo; a < pb_hi; a++)
+        if (pbm[a])
+          ds[a] &= pb[a];
+      break;
+
+    case UPDI_V0_NVMCTRL_CTRLA_PAGE_BUFFER_CLR:
+      break;
+
+    case UPDI_V0_NVMCTRL_CTRLA_CHIP_ERASE:
+      nvm_erase_range(flash_offset, flash_offset + flash_size);
+      nvm_erase_range(EEPROM_BASE, EEPROM_BASE + eeprom_size);
+      break;
+
+    case UPDI_V0_NVMCTRL_CTRLA_ERASE_EEPROM:
+      nvm_erase_range(EEPROM_BASE, EEPROM_BASE + eeprom_size);
+      break;
+
+    case UPDI_V0_NVMCTRL_CTRLA_WRITE_FUSE:
+      a = nvm_regs[UPDI_NVMCTRL_ADDRL] | (nvm_regs[UPDI_NVMCTRL_ADDRH] << 8);
+      ds[a] = nvm_regs[UPDI_NVMCTRL_DATAL];
+      return;
+
+    default:
+      return;
+  }
+
+  /* every command but a fuse write consumes the page buffer */
+  if (pb_lo < pb_hi)
+    memset(pbm + pb_lo, 0, pb_hi - pb_lo);
+  pb_lo = DS_SIZE;
+  pb_hi = 0;
+}
+
+
+static unsigned char ds_rd(unsigned long a)
+{
+  a &= DS_SIZE - 1;
+  if (a >= NVMCTRL_BASE && a < NVMCTRL_BASE + 16) {
+    /* commands complete at once, the controller is never busy */
+    if (a - NVMCTRL_BASE == UPDI_NVMCTRL_STATUS)
+      return 0;
+    return nvm_regs[a - NVMCTRL_BASE];
+  }
+  return ds[a];
+}
+
+
+static void ds_wr(unsigned long a, unsigned char v)
+{
+  a &= DS_SIZE - 1;
+  if (a >= NVMCTRL_BASE && a < NVMCTRL_BASE + 16) {
+    nvm_regs[a - NVMCTRL_BASE] = v;
+    if (a - NVMCTRL_BASE == UPDI_NVMCTRL_CTRLA)
+      nvm_command(v);
+  } else if (ds_is_nvm(a)) {
+    pb[a] = v;
+    pbm[a] = 1;
+    if (a < pb_lo)
+      pb_lo = a;
+    if (a + 1 > pb_hi)
+      pb_hi = a + 1;
+  } else if (a < SIGROW_BASE || a >= SIGROW_BASE + 0x80) {
+    ds[a] = v;
+  }
+}
+
+
+static void updi_reset(void)
+{
+  rsd = 0;
+  repeat = 0;
+  memset(cs, 0, sizeof(cs));
+  cs[UPDI_CS_STATUSA] = 0x30;           /* UPDI revision 3 */
+}
+
+
+static unsigned char updi_cs_rd(unsigned int a)
+{
+  switch (a) {
+    case UPDI_ASI_KEY_STATUS:
+      return key_status;
+    case UPDI_ASI_SYS_STATUS:
+      return (locked? 1 << UPDI_ASI_SYS_STATUS_LOCKSTATUS: 0) |
+             (nvmprog? 1 << UPDI_ASI_SYS_STATUS_NVMPROG: 0) |
+             (in_reset? 1 << UPDI_ASI_SYS_STATUS_RSTSYS: 0);
+  }
+  return cs[a];
+}
+
+
+static void updi_cs_wr(unsigned int a, unsigned char v)
+{
+  cs[a] = v;
+  switch (a) {
+    case UPDI_CS_CTRLA:
+      rsd = (v >> UPDI_CTRLA_RSD_BIT) & 1;
+      break;
+
+    case UPDI_CS_CTRLB:
+      if (v & (1 << UPDI_CTRLB_UPDIDIS_BIT)) {
+        trace("UPDI disabled");
+        nvmprog = 0;
+        key_status = 0;
+      }
+      break;
+
+    case UPDI_ASI_RESET_REQ:
+      if (v == UPDI_RESET_REQ_VALUE) {
+        in_reset = 1;
+      } else if (in_reset) {
+        /* keys take effect when the reset is released */
+        in_reset = 0;
+        if (key_status & (1 << UPDI_ASI_KEY_STATUS_CHIPERASE)) {
+          trace("chip erase key");
+          nvm_command(UPDI_V0_NVMCTRL_CTRLA_CHIP_ERASE);
+          locked = 0;
+        }
+        if (key_status & (1 << UPDI_ASI_KEY_STATUS_NVMPROG))
+          nvmprog = 1;
+        key_status = 0;
+      }
+      break;
+  }
+}
+
+
+static unsigned long updi_get(int n)
+{
+  unsigned long v = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    v |= (unsigned long)getb() << (8 * i);
+  return v;
+}
+
+
+static void updi_ack(void)
+{
+  if (!rsd)
+    putb(UPDI_PHY_ACK);
+}
+
+
+static void updi_instruction(void)
+{
+  unsigned char op = getb();
+  unsigned int asize = ((op >> 2) & 0x03) + 1;
+  unsigned int dsize = (op & 0x03) + 1;
+  unsigned int n = repeat? repeat: 1;
+  unsigned int i, r;
+  unsigned long a;
+  unsigned char key[256];
+  char sib[33];
+
+  repeat = 0;
+  switch (op & 0xe0) {
+    case UPDI_LDS:
+      a = updi_get(asize);
+      for (i = 0; i < dsize; i++)
+        putb(ds_rd(a + i));
+      break;
+
+    case UPDI_STS:
+      a = updi_get(asize);
+      updi_ack();
+      for (i = 0; i < dsize; i++)
+        ds_wr(a + i, getb());
+      updi_ack();
+      break;
+
+    case UPDI_LD:
+      if ((op & 0x0c) == UPDI_PTR_ADDRESS) {
+        for (i = 0; i < dsize; i++)
+          putb((ptr >> (8 * i)) & 0xff);
+        break;
+      }
+      trace("LD%u x %u from 0x%04lx", dsize * 8, n, ptr);
+      for (r = 0; r < n; r++) {
+        for (i = 0; i < dsize; i++)
+          putb(ds_rd(ptr + i));
+        if (op & UPDI_PTR_INC)
+          ptr += dsize;
+      }
+      break;
+
+    case UPDI_ST:
+      if ((op & 0x0c) == UPDI_PTR_ADDRESS) {
+        ptr = updi_get(dsize);
+        updi_ack();
+        break;
+      }
+      trace("ST%u x %u to 0x%04lx%s", dsize * 8, n, ptr, rsd? " (RSD)": "");
+      for (r = 0; r < n; r++) {
+        for (i = 0; i < dsize; i++)
+          ds_wr(ptr + i, getb());
+        if (op & UPDI_PTR_INC)
+          ptr += dsize;
+        updi_ack();
+      }
+      break;
+
+    case UPDI_LDCS:
+      putb(updi_cs_rd(op & 0x0f));
+      break;
+
+    case UPDI_STCS:
+      updi_cs_wr(op & 0x0f, getb());
+      break;
+
+    case UPDI_REPEAT:
+      repeat = updi_get((op & 0x03) == UPDI_REPEAT_WORD? 2: 1) + 1;
+      break;
+
+    case UPDI_KEY:
+      n = 8 << (op & 0x03);
+      if (op & UPDI_KEY_SIB) {
+        memset(sib, 0, sizeof(sib));
+        snprintf(sib, sizeof(sib), "%s P:0D:1-3M2 (01.59B14.0)",
+                 flash_offset < 0x8000? "megaAVR": "tinyAVR");
+        for (i = 0; i < n; i++)
+          putb(i < sizeof(sib)? sib[i]: 0);
+        break;
+      }
+      /* keys are sent last byte first */
+      for (i = 0; i < n; i++)
+        key[n - 1 - i] = getb();
+      if (n == 8 && memcmp(key, UPDI_KEY_NVM, 8) == 0)
+        key_status |= 1 << UPDI_ASI_KEY_STATUS_NVMPROG;
+      else if (n == 8 && memcmp(key, UPDI_KEY_CHIPERASE, 8) == 0)
+        key_status |= 1 << UPDI_ASI_KEY_STATUS_CHIPERASE;
+      else
+        trace("unknown key");
+      break;
+  }
+}
+
+
+static void updi_cmd(void)
+{
+  unsigned char c = getb();
+
+  if (c == UPDI_PHY_SYNC)
+    updi_instruction();
+  else if (c == UPDI_BREAK)
+    updi_reset();
+  else
+    trace("ignoring 0x%02x outside a frame", c);
+}
+
+
+static void updi_init(void)
+{
+  static const unsigned char fuses[] = {
+    0x00, 0x00, 0x02, 0xff, 0x00, 0xf6, 0x07, 0xff, 0x00, 0x00, 0xc5
+  };
+
+  memset(ds, 0, sizeof(ds));
+  nvm_erase_range(0, DS_SIZE);
+  memcpy(ds + SIGROW_BASE, sig, 3);
+  memcpy(ds + FUSES_BASE, fuses, sizeof(fuses));
+  updi_reset();
+}
+
+
+static int open_pty(void)
+{
+  struct termios t;
+  char * name;
+  int sfd;
+
+  mfd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (mfd < 0 || grantpt(mfd) < 0 || unlockpt(mfd) < 0 ||
+      (name = ptsname(mfd)) == NULL) {
+    fprintf(stderr, "%s: cannot allocate a pseudo terminal: %s\n",
+            progname, strerror(errno));
+    return -1;
+  }
+
+  /*
+   * Keep the slave open ourselves: the programmers close and reopen
+   * the port (e.g. for the UPDI double break), and the master would
+   * see a hangup in between otherwise.
+   */
+  sfd = open(name, O_RDWR | O_NOCTTY);
+  if (sfd < 0 || tcgetattr(sfd, &t) < 0) {
+    fprintf(stderr, "%s: cannot open %s: %s\n", progname, name,
+            strerror(errno));
+    return -1;
+  }
+  cfmakeraw(&t);
+  tcsetattr(sfd, TCSANOW, &t);
+
+  printf("%s\n", name);
+  fflush(stdout);
+  return 0;
+}
+
+
+int main(int argc, char * argv[])
+{
+  unsigned long s;
+  char * e;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "b:d:e:f:g:l:o:p:s:v?")) != -1) {
+    switch (ch) {
+      case 'b': baud = strtol(optarg, NULL, 0); break;
+      case 'd': devcode = strtoul(optarg, NULL, 0); break;
+      case 'e': eeprom_size = strtoul(optarg, NULL, 0); break;
+      case 'f': flash_size = strtoul(optarg, NULL, 0); break;
+      case 'g': page_size = strtoul(optarg, NULL, 0); break;
+      case 'l': latency_us = strtol(optarg, NULL, 0); break;
+      case 'o': flash_offset = strtoul(optarg, NULL, 0); break;
+      case 'v': verbose++; break;
+
+      case 'p':
+        if (strcmp(optarg, "stk500v1") == 0)
+          proto = PROTO_STK500V1;
+        else if (strcmp(optarg, "avr109") == 0)
+          proto = PROTO_AVR109;
+        else if (strcmp(optarg, "avr910") == 0)
+          proto = PROTO_AVR910;
+        else if (strcmp(optarg, "updi") == 0)
+          proto = PROTO_UPDI;
+        else {
+          fprintf(stderr, "%s: unknown protocol \"%s\"\n", progname, optarg);
+          return 1;
+        }
+        break;
+
+      case 's':
+        s = strtoul(optarg, &e, 16);
+        if (*e || e == optarg || s > 0xffffff) {
+          fprintf(stderr, "%s: invalid signature \"%s\"\n", progname, optarg);
+          return 1;
+        }
+        sig[0] = s >> 16;
+        sig[1] = s >> 8;
+        sig[2] = s;
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  if (page_size == 0 || page_size > 0x8000) {
+    fprintf(stderr, "%s: invalid page size %u\n", progname, page_size);
+    return 1;
+  }
+  if (proto == PROTO_UPDI &&
+      (flash_offset + flash_size > DS_SIZE ||
+       EEPROM_BASE + eeprom_size > flash_offset)) {
+    fprintf(stderr, "%s: memories do not fit into the UPDI data space\n",
+            progname);
+    return 1;
+  }
+
+  flash = malloc(flash_size);
+  eeprom = malloc(eeprom_size);
+  if (flash == NULL || eeprom == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    return 1;
+  }
+  chip_erase();
+  for (s = 0; s < flash_size; s++)
+    flash[s] = s * 7;
+  if (proto == PROTO_UPDI)
+    updi_init();
+
+  if (open_pty() < 0)
+    return 1;
+
+  for (;;) {
+    switch (proto) {
+      case PROTO_STK500V1: stk500v1_cmd(); break;
+      case PROTO_AVR109:
+      case PROTO_AVR910: avr109_cmd(); break;
+      case PROTO_UPDI: updi_cmd(); break;
+    }
+  }
+
+  return 0;
+}
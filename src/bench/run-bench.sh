@@ -0,0 +1,157 @@
+#! /bin/sh
+#
+# avrdude - A Downloader/Uploader for AVR device programmers
+# Copyright (C) 2022 The AVRDUDE authors
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+# $Id$
+
+# Benchmark the serial programmers against the bootloader emulator:
+# write, verify and read back a random flash image for a few parts of
+# different flash sizes per protocol, and report the time, throughput
+# and round trips of each step as measured by "avrdude -T".
+#
+# Usage: run-bench.sh <avrdude> <bootemu> <avrdude.conf> [<workdir>]
+#
+# The wire can be slowed down from the environment:
+#   BENCH_BAUD     emulate the wire time at this baud rate (default: none)
+#   BENCH_LATENCY  turnaround latency in microseconds (default: 0)
+#   BENCH_FILTER   only run the cases whose label contains this string
+
+AVRDUDE=${1:?"usage: $0 <avrdude> <bootemu> <avrdude.conf> [<workdir>]"}
+BOOTEMU=${2:?"usage: $0 <avrdude> <bootemu> <avrdude.conf> [<workdir>]"}
+CONF=${3:?"usage: $0 <avrdude> <bootemu> <avrdude.conf> [<workdir>]"}
+WORKDIR=${4:-bench-results}
+
+BENCH_BAUD=${BENCH_BAUD:-0}
+BENCH_LATENCY=${BENCH_LATENCY:-0}
+
+mkdir -p "$WORKDIR" || exit 1
+RESULTS="$WORKDIR/results.json"
+: > "$RESULTS"
+failed=0
+
+printf "%-24s %-8s %10s %10s %8s\n" "case" "phase" "ms" "bytes/s" "trips"
+
+# bench <label> <emulator options> -- <avrdude options>
+bench()
+{
+    label=$1
+    shift
+
+    case "$label" in
+        *"$BENCH_FILTER"*) ;;
+        *) return ;;
+    esac
+
+    emuopts=
+    while [ "$1" != "--" ]; do
+        [ "$1" = "-f" ] && size=$2
+        emuopts="$emuopts $1"
+        shift
+    done
+    shift
+
+    ptyfile="$WORKDIR/$label.pty"
+    : > "$ptyfile"
+    "$BOOTEMU" $emuopts -b "$BENCH_BAUD" -l "$BENCH_LATENCY" \
+        > "$ptyfile" 2> "$WORKDIR/$label.emu.log" &
+    emupid=$!
+
+    tries=0
+    while [ ! -s "$ptyfile" ] && [ $tries -lt 50 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    pty=$(cat "$ptyfile")
+    if [ -z "$pty" ]; then
+        echo "$label: emulator did not start" >&2
+        kill $emupid 2> /dev/null
+        failed=1
+        return
+    fi
+
+    image="$WORKDIR/$label.in"
+    readback="$WORKDIR/$label.out"
+    dd if=/dev/urandom of="$image" bs=1024 count=$((size / 1024)) 2> /dev/null
+    # blank a quarter in the middle, the emulated flash is not blank
+    dd if=/dev/zero bs=1024 count=$((size / 4096)) 2> /dev/null |
+        tr '\000' '\377' > "$WORKDIR/$label.blank"
+    dd if="$WORKDIR/$label.blank" of="$image" bs=1024 seek=$((size / 2048)) \
+        conv=notrunc 2> /dev/null
+
+    json="$WORKDIR/$label.json"
+    rm -f "$json"
+    if ! "$AVRDUDE" -C "$CONF" -P "$pty" -b 115200 "$@" \
+            -U flash:w:"$image":r -U flash:r:"$readback":r \
+            -T json:"$json" > "$WORKDIR/$label.log" 2>&1 ||
+       ! cmp -s "$image" "$readback"; then
+        echo "$label: FAILED, see $WORKDIR/$label.log" >&2
+        failed=1
+    fi
+    kill $emupid 2> /dev/null
+    wait $emupid 2> /dev/null
+
+    [ -s "$json" ] || return
+    cat "$json" >> "$RESULTS"
+    awk -v label="$label" '{
+        n = split($0, ph, /\{"name":"/)
+        for (i = 2; i <= n; i++) {
+            name = substr(ph[i], 1, index(ph[i], "\"") - 1)
+            if (name !~ /^flash:/)
+                continue
+            match(ph[i], /"ms":[0-9.]+/)
+            ms = substr(ph[i], RSTART + 5, RLENGTH - 5)
+            match(ph[i], /"bytes":[0-9]+/)
+            bytes = substr(ph[i], RSTART + 8, RLENGTH - 8)
+            match(ph[i], /"round_trips":[0-9]+/)
+            trips = substr(ph[i], RSTART + 14, RLENGTH - 14)
+            rate = ms > 0? bytes * 1000 / ms: 0
+            printf "%-24s %-8s %10.1f %10.0f %8d\n", label, name, ms,
+                   rate, trips
+        }
+    }' "$json"
+}
+
+# STK500v1 (optiboot) through the arduino programmer
+bench stk500v1-m168 -p stk500v1 -f 16384 -e 512 -g 128 -s 1e9406 -- \
+    -c arduino -p m168
+bench stk500v1-m328p -p stk500v1 -f 32768 -e 1024 -g 128 -s 1e950f -- \
+    -c arduino -p m328p
+bench stk500v1-m2560 -p stk500v1 -f 262144 -e 4096 -g 256 -s 1e9801 -- \
+    -c arduino -p m2560
+
+# AVR109 through the butterfly programmer
+bench avr109-m328p -p avr109 -f 32768 -e 1024 -g 128 -s 1e950f -- \
+    -c butterfly -p m328p
+bench avr109-m2560 -p avr109 -f 262144 -e 4096 -g 256 -s 1e9801 -- \
+    -c butterfly -p m2560
+
+# AVR910, byte at a time
+bench avr910-m8 -p avr910 -d 0x76 -f 8192 -e 512 -g 64 -s 1e9307 -- \
+    -c avr910 -p m8
+bench avr910-m32 -p avr910 -d 0x72 -f 32768 -e 1024 -g 128 -s 1e9502 -- \
+    -c avr910 -p m32
+
+# UPDI through the serialupdi programmer
+bench updi-t414 -p updi -f 4096 -e 128 -g 64 -o 0x8000 -s 1e9222 -- \
+    -c serialupdi -p t414
+bench updi-t1614 -p updi -f 16384 -e 256 -g 64 -o 0x8000 -s 1e9422 -- \
+    -c serialupdi -p t1614
+bench updi-m4809 -p updi -f 49152 -e 256 -g 128 -o 0x4000 -s 1e9651 -- \
+    -c serialupdi -p m4809
+
+echo "JSON reports collected in $RESULTS"
+exit $failed
@@ -1121,7 +1121,7 @@ static int buspirate_chip_erase(struct programmer_t *pgm, AVRPART * p)
 
 	avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
 	pgm->cmd(pgm, cmd, res);
-	usleep(p->chip_erase_delay);
+	avr_wait_ready(pgm, p, p->chip_erase_delay);
 	pgm->initialize(pgm, p);
 
 	pgm->pgm_led(pgm, OFF);
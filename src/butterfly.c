@@ -751,6 +751,9 @@ void butterfly_initpgm(PROGRAMMER * pgm)
   pgm->setup          = butterfly_setup;
   pgm->teardown       = butterfly_teardown;
   pgm->flag = 0;
+
+  /* the bootloader may ignore or only partly do a chip erase */
+  pgm->erase_blanks = 0;
 }
 
 const char butterfly_mk_desc[] = "Mikrokopter.de Butterfly";
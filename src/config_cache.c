@@ -0,0 +1,619 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2022 The AVRDUDE authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Binary cache of a parsed configuration file.
+ *
+ * Parsing the system wide avrdude.conf (several hundred parts, most
+ * of them derived from a parent part) accounts for a noticeable part
+ * of the run time of short avrdude invocations.  After a successful
+ * parse, the resulting part and programmer lists are dumped into a
+ * cache file, together with the path, size, modification time and a
+ * hash of the configuration file they have been built from.  On the
+ * next run, the lists are restored from the cache instead of running
+ * the parser, as long as all these keys still match.
+ *
+ * The cache is private to the avrdude binary that wrote it: structure
+ * layouts are stored verbatim where possible, so the header records
+ * the relevant structure sizes, and any mismatch simply causes the
+ * cache to be rebuilt.
+ */
+
+#include "ac_cfg.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avrdude.h"
+#include "libavrdude.h"
+#include "config.h"
+
+#define CACHE_MAGIC   "AVRDCCH"
+#define CACHE_VERSION 2
+
+/* all bytes of an AVRPART/AVRMEM up to the first pointer member */
+#define PART_DATALEN  offsetof(AVRPART, op)
+#define MEM_DATALEN   offsetof(AVRMEM, buf)
+
+struct cache_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t part_datalen;
+  uint32_t mem_datalen;
+  uint32_t pindef_size;
+  uint32_t n_pins;
+  uint32_t conf_size;
+  int64_t  conf_mtime;
+  uint64_t conf_hash;
+};
+
+struct cache_reader {
+  const unsigned char * p;
+  const unsigned char * end;
+};
+
+struct type_lookup {
+  void (*initpgm)(struct programmer_t * pgm);
+  const char * id;
+};
+
+
+/*
+ * FNV-1a hash over the contents of the configuration file.
+ */
+static int cache_hash_file(const char * file, uint64_t * hash)
+{
+  FILE * f;
+  unsigned char buf[4096];
+  size_t n, i;
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  f = fopen(file, "rb");
+  if (f == NULL)
+    return -1;
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    for (i = 0; i < n; i++) {
+      h ^= buf[i];
+      h *= 0x100000001b3ULL;
+    }
+  }
+
+  if (ferror(f)) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  *hash = h;
+  return 0;
+}
+
+
+static int cache_fill_header(const char * file, struct cache_header * hdr)
+{
+  struct stat sb;
+
+  if (stat(file, &sb) < 0)
+    return -1;
+
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  hdr->version      = CACHE_VERSION;
+  hdr->part_datalen = PART_DATALEN;
+  hdr->mem_datalen  = MEM_DATALEN;
+  hdr->pindef_size  = sizeof(struct pindef_t);
+  hdr->n_pins       = N_PINS;
+  hdr->conf_size    = (uint32_t)sb.st_size;
+  hdr->conf_mtime   = (int64_t)sb.st_mtime;
+
+  return cache_hash_file(file, &hdr->conf_hash);
+}
+
+
+/*
+ * Writer side.  All cache_put*() functions return 0 on success and
+ * -1 on a write error, so they can be chained with ||.
+ */
+static int cache_put(FILE * f, const void * data, size_t len)
+{
+  return fwrite(data, 1, len, f) == len ? 0 : -1;
+}
+
+static int cache_put_u32(FILE * f, uint32_t v)
+{
+  return cache_put(f, &v, sizeof(v));
+}
+
+static int cache_put_str(FILE * f, const char * s)
+{
+  uint32_t len = strlen(s);
+
+  return cache_put_u32(f, len) || cache_put(f, s, len);
+}
+
+/*
+ * Opcodes are stored as a presence mask followed by the defined
+ * opcodes, with each command bit packed into 16 bits.
+ */
+static int cache_put_ops(FILE * f, OPCODE * const ops[AVR_OP_MAX])
+{
+  uint32_t mask = 0;
+  uint16_t bits[32];
+  int i, j;
+
+  for (i = 0; i < AVR_OP_MAX; i++)
+    if (ops[i])
+      mask |= 1U << i;
+  if (cache_put_u32(f, mask))
+    return -1;
+
+  for (i = 0; i < AVR_OP_MAX; i++) {
+    if (ops[i] == NULL)
+      continue;
+    for (j = 0; j < 32; j++) {
+      CMDBIT b;
+      avr_opcode_bit(ops[i], j, &b);
+      if (b.type < 0 || b.type > 7 || b.value < 0 || b.value > 1 ||
+          b.bitno < 0 || b.bitno > 0x0fff)
+        return -1;
+      bits[j] = b.type | (b.value << 3) | (b.bitno << 4);
+    }
+    if (cache_put(f, bits, sizeof(bits)))
+      return -1;
+  }
+
+  return 0;
+}
+
+static void cache_type_cb(const char * id, const char * desc, void * cookie)
+{
+  struct type_lookup * tl = cookie;
+  const PROGRAMMER_TYPE * t;
+
+  if (tl->id != NULL)
+    return;
+  t = locate_programmer_type(id);
+  if (t != NULL && t->initpgm == tl->initpgm)
+    tl->id = id;
+}
+
+static int cache_put_part(FILE * f, AVRPART * p)
+{
+  LNODEID ln;
+  AVRMEM * m;
+
+  if (cache_put(f, p, PART_DATALEN) || cache_put_ops(f, p->op) ||
+      cache_put_str(f, p->config_file) || cache_put_u32(f, p->lineno) ||
+      cache_put_u32(f, lsize(p->mem)))
+    return -1;
+
+  for (ln = lfirst(p->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    if (cache_put(f, m, MEM_DATALEN) || cache_put_ops(f, m->op))
+      return -1;
+  }
+
+  return 0;
+}
+
+static int cache_put_pgm(FILE * f, PROGRAMMER * pgm)
+{
+  struct type_lookup tl;
+  LNODEID ln;
+
+  tl.initpgm = pgm->initpgm;
+  tl.id = NULL;
+  walk_programmer_types(cache_type_cb, &tl);
+  if (tl.id == NULL)
+    return -1;
+
+  if (cache_put_u32(f, lsize(pgm->id)))
+    return -1;
+  for (ln = lfirst(pgm->id); ln; ln = lnext(ln))
+    if (cache_put_str(f, ldata(ln)))
+      return -1;
+
+  if (cache_put_u32(f, lsize(pgm->usbpid)))
+    return -1;
+  for (ln = lfirst(pgm->usbpid); ln; ln = lnext(ln))
+    if (cache_put_u32(f, *(int *)ldata(ln)))
+      return -1;
+
+  return cache_put_str(f, tl.id) ||
+    cache_put_str(f, pgm->desc) ||
+    cache_put_str(f, pgm->type) ||
+    cache_put_str(f, pgm->port) ||
+    cache_put(f, pgm->pinno, sizeof(pgm->pinno)) ||
+    cache_put(f, pgm->pin, sizeof(pgm->pin)) ||
+    cache_put_u32(f, pgm->exit_vcc) ||
+    cache_put_u32(f, pgm->exit_reset) ||
+    cache_put_u32(f, pgm->exit_datahigh) ||
+    cache_put_u32(f, pgm->conntype) ||
+    cache_put_u32(f, pgm->ppidata) ||
+    cache_put_u32(f, pgm->ppictrl) ||
+    cache_put_u32(f, pgm->baudrate) ||
+    cache_put_u32(f, pgm->usbvid) ||
+    cache_put_str(f, pgm->usbdev) ||
+    cache_put_str(f, pgm->usbsn) ||
+    cache_put_str(f, pgm->usbvendor) ||
+    cache_put_str(f, pgm->usbproduct) ||
+    cache_put(f, &pgm->bitclock, sizeof(pgm->bitclock)) ||
+    cache_put_u32(f, pgm->ispdelay) ||
+    cache_put_u32(f, pgm->page_size) ||
+    cache_put_str(f, pgm->config_file) ||
+    cache_put_u32(f, pgm->lineno);
+}
+
+static int cache_write(const char * file, const char * cachefile)
+{
+  struct cache_header hdr;
+  char tmpname[PATH_MAX];
+  FILE * f;
+  LNODEID ln;
+  int rc;
+
+  if (cache_fill_header(file, &hdr) < 0)
+    return -1;
+
+  /* one temporary file per process, parallel runs may write at once */
+  if (snprintf(tmpname, sizeof(tmpname), "%s.%ld.tmp", cachefile,
+               (long) getpid()) >= (int)sizeof(tmpname))
+    return -1;
+
+  f = fopen(tmpname, "wb");
+  if (f == NULL)
+    return -1;
+
+  rc = cache_put(f, &hdr, sizeof(hdr)) ||
+    cache_put_str(f, file) ||
+    cache_put_str(f, default_programmer) ||
+    cache_put_str(f, default_parallel) ||
+    cache_put_str(f, default_serial) ||
+    cache_put(f, &default_bitclock, sizeof(default_bitclock)) ||
+    cache_put_u32(f, default_safemode);
+
+  if (rc == 0)
+    rc = cache_put_u32(f, lsize(part_list));
+  for (ln = lfirst(part_list); rc == 0 && ln; ln = lnext(ln))
+    rc = cache_put_part(f, ldata(ln));
+
+  if (rc == 0)
+    rc = cache_put_u32(f, lsize(programmers));
+  for (ln = lfirst(programmers); rc == 0 && ln; ln = lnext(ln))
+    rc = cache_put_pgm(f, ldata(ln));
+
+  if (fclose(f) != 0)
+    rc = -1;
+
+#if defined(WIN32)
+  if (rc == 0)
+    remove(cachefile);
+#endif
+  if (rc == 0 && rename(tmpname, cachefile) < 0)
+    rc = -1;
+  if (rc != 0)
+    remove(tmpname);
+
+  return rc;
+}
+
+
+/*
+ * Reader side.  Like the writer, all cache_get*() functions return 0
+ * on success and -1 if the cache is truncated or inconsistent.
+ */
+static int cache_get(struct cache_reader * rd, void * data, size_t len)
+{
+  if ((size_t)(rd->end - rd->p) < len)
+    return -1;
+  memcpy(data, rd->p, len);
+  rd->p += len;
+  return 0;
+}
+
+static int cache_get_u32(struct cache_reader * rd, uint32_t * v)
+{
+  return cache_get(rd, v, sizeof(*v));
+}
+
+static int cache_get_int(struct cache_reader * rd, int * v)
+{
+  uint32_t u;
+
+  if (cache_get_u32(rd, &u))
+    return -1;
+  *v = (int)u;
+  return 0;
+}
+
+static int cache_get_str(struct cache_reader * rd, char * s, size_t size)
+{
+  uint32_t len;
+
+  if (cache_get_u32(rd, &len) || len >= size || cache_get(rd, s, len))
+    return -1;
+  s[len] = 0;
+  return 0;
+}
+
+static int cache_get_ops(struct cache_reader * rd, OPCODE * ops[AVR_OP_MAX])
+{
+  uint32_t mask;
+  uint16_t bits[32];
+  CMDBIT b[32];
+  int i, j;
+
+  if (cache_get_u32(rd, &mask))
+    return -1;
+
+  for (i = 0; i < AVR_OP_MAX; i++) {
+    if ((mask & (1U << i)) == 0)
+      continue;
+    if (cache_get(rd, bits, sizeof(bits)))
+      return -1;
+    for (j = 0; j < 32; j++) {
+      b[j].type  = bits[j] & 0x07;
+      b[j].value = (bits[j] >> 3) & 0x01;
+      b[j].bitno = bits[j] >> 4;
+    }
+    ops[i] = avr_new_opcode();
+    if (avr_compile_opcode(ops[i], b) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static AVRPART * cache_get_part(struct cache_reader * rd)
+{
+  AVRPART * p;
+  AVRMEM * m;
+  uint32_t nmem, i;
+
+  p = avr_new_part();
+  if (cache_get(rd, p, PART_DATALEN) || cache_get_ops(rd, p->op) ||
+      cache_get_str(rd, p->config_file, sizeof(p->config_file)) ||
+      cache_get_int(rd, &p->lineno) || cache_get_u32(rd, &nmem)) {
+    avr_free_part(p);
+    return NULL;
+  }
+
+  for (i = 0; i < nmem; i++) {
+    m = avr_new_memtype();
+    ladd(p->mem, m);
+    if (cache_get(rd, m, MEM_DATALEN) || cache_get_ops(rd, m->op)) {
+      avr_free_part(p);
+      return NULL;
+    }
+  }
+
+  return p;
+}
+
+static PROGRAMMER * cache_get_pgm(struct cache_reader * rd)
+{
+  const PROGRAMMER_TYPE * t;
+  PROGRAMMER * pgm;
+  char id[MAX_STR_CONST];
+  uint32_t n, i;
+  int * ip;
+
+  pgm = pgm_new();
+  if (pgm == NULL)
+    return NULL;
+
+  if (cache_get_u32(rd, &n))
+    goto fail;
+  for (i = 0; i < n; i++) {
+    if (cache_get_str(rd, id, sizeof(id)))
+      goto fail;
+    ladd(pgm->id, strdup(id));
+  }
+
+  if (cache_get_u32(rd, &n))
+    goto fail;
+  for (i = 0; i < n; i++) {
+    ip = malloc(sizeof(int));
+    if (ip == NULL)
+      goto fail;
+    ladd(pgm->usbpid, ip);
+    if (cache_get_int(rd, ip))
+      goto fail;
+  }
+
+  if (cache_get_str(rd, id, sizeof(id)) ||
+      (t = locate_programmer_type(id)) == NULL)
+    goto fail;
+  pgm->initpgm = t->initpgm;
+
+  if (cache_get_str(rd, pgm->desc, sizeof(pgm->desc)) ||
+      cache_get_str(rd, pgm->type, sizeof(pgm->type)) ||
+      cache_get_str(rd, pgm->port, sizeof(pgm->port)) ||
+      cache_get(rd, pgm->pinno, sizeof(pgm->pinno)) ||
+      cache_get(rd, pgm->pin, sizeof(pgm->pin)) ||
+      cache_get_int(rd, (int *)&pgm->exit_vcc) ||
+      cache_get_int(rd, (int *)&pgm->exit_reset) ||
+      cache_get_int(rd, (int *)&pgm->exit_datahigh) ||
+      cache_get_int(rd, (int *)&pgm->conntype) ||
+      cache_get_int(rd, &pgm->ppidata) ||
+      cache_get_int(rd, &pgm->ppictrl) ||
+      cache_get_int(rd, &pgm->baudrate) ||
+      cache_get_int(rd, &pgm->usbvid) ||
+      cache_get_str(rd, pgm->usbdev, sizeof(pgm->usbdev)) ||
+      cache_get_str(rd, pgm->usbsn, sizeof(pgm->usbsn)) ||
+      cache_get_str(rd, pgm->usbvendor, sizeof(pgm->usbvendor)) ||
+      cache_get_str(rd, pgm->usbproduct, sizeof(pgm->usbproduct)) ||
+      cache_get(rd, &pgm->bitclock, sizeof(pgm->bitclock)) ||
+      cache_get_int(rd, &pgm->ispdelay) ||
+      cache_get_int(rd, &pgm->page_size) ||
+      cache_get_str(rd, pgm->config_file, sizeof(pgm->config_file)) ||
+      cache_get_int(rd, &pgm->lineno))
+    goto fail;
+
+  return pgm;
+
+ fail:
+  pgm_free(pgm);
+  return NULL;
+}
+
+/*
+ * Restore part_list, programmers and the config defaults from the
+ * cache.  Returns 0 if the cache was up to date and could be loaded,
+ * -1 otherwise.  On failure, all lists and defaults are left untouched.
+ */
+static int cache_load(const char * file, const char * cachefile)
+{
+  struct cache_header want, hdr;
+  struct cache_reader rd;
+  unsigned char * buf;
+  char path[PATH_MAX];
+  char def_programmer[MAX_STR_CONST];
+  char def_parallel[PATH_MAX], def_serial[PATH_MAX];
+  double def_bitclock;
+  int def_safemode;
+  LISTID parts, pgms;
+  AVRPART * p;
+  PROGRAMMER * pgm;
+  struct stat sb;
+  uint32_t n, i;
+  FILE * f;
+  int rc = -1;
+
+  f = fopen(cachefile, "rb");
+  if (f == NULL)
+    return -1;
+
+  if (fstat(fileno(f), &sb) < 0 || sb.st_size < (off_t)sizeof(hdr) ||
+      fread(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+      cache_fill_header(file, &want) < 0 ||
+      memcmp(&hdr, &want, sizeof(hdr)) != 0) {
+    fclose(f);
+    return -1;
+  }
+
+  buf = malloc(sb.st_size - sizeof(hdr));
+  if (buf == NULL ||
+      fread(buf, 1, sb.st_size - sizeof(hdr), f) != sb.st_size - sizeof(hdr)) {
+    free(buf);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  rd.p = buf;
+  rd.end = buf + (sb.st_size - sizeof(hdr));
+  parts = lcreat(NULL, 0);
+  pgms = lcreat(NULL, 0);
+
+  if (cache_get_str(&rd, path, sizeof(path)) || strcmp(path, file) != 0 ||
+      cache_get_str(&rd, def_programmer, sizeof(def_programmer)) ||
+      cache_get_str(&rd, def_parallel, sizeof(def_parallel)) ||
+      cache_get_str(&rd, def_serial, sizeof(def_serial)) ||
+      cache_get(&rd, &def_bitclock, sizeof(def_bitclock)) ||
+      cache_get_int(&rd, &def_safemode))
+    goto done;
+
+  if (cache_get_u32(&rd, &n))
+    goto done;
+  for (i = 0; i < n; i++) {
+    if ((p = cache_get_part(&rd)) == NULL)
+      goto done;
+    ladd(parts, p);
+  }
+
+  if (cache_get_u32(&rd, &n))
+    goto done;
+  for (i = 0; i < n; i++) {
+    if ((pgm = cache_get_pgm(&rd)) == NULL)
+      goto done;
+    ladd(pgms, pgm);
+  }
+
+  if (rd.p != rd.end)
+    goto done;
+
+  strcpy(default_programmer, def_programmer);
+  strcpy(default_parallel, def_parallel);
+  strcpy(default_serial, def_serial);
+  default_bitclock = def_bitclock;
+  default_safemode = def_safemode;
+
+  lcat(part_list, parts);
+  lcat(programmers, pgms);
+  rc = 0;
+
+ done:
+  /* after lcat() these are empty */
+  ldestroy_cb(parts, (void(*)(void*))avr_free_part);
+  ldestroy_cb(pgms, (void(*)(void*))pgm_free);
+  free(buf);
+
+  return rc;
+}
+
+
+/*
+ * Read a configuration file, using the cache in cachefile if it is up
+ * to date with respect to file.  Otherwise (or if rebuild is set),
+ * file is parsed and the cache is written afresh.  cachefile may be
+ * NULL or empty, in which case this is the same as read_config().
+ *
+ * The cache describes the state after parsing file alone, so this
+ * must only be used for the first configuration file being read.
+ */
+int read_config_cached(const char * file, const char * cachefile, int rebuild)
+{
+  int rc, fresh;
+
+  fresh = lsize(part_list) == 0 && lsize(programmers) == 0;
+  if (cachefile == NULL || cachefile[0] == 0 || !fresh)
+    return read_config(file);
+
+  if (!rebuild) {
+    if (cache_load(file, cachefile) == 0) {
+      avrdude_message(MSG_DEBUG, "%s: using configuration cache \"%s\"\n",
+                      progname, cachefile);
+      return 0;
+    }
+  }
+
+  rc = read_config(file);
+  if (rc != 0)
+    return rc;
+
+  if (cache_write(file, cachefile) != 0) {
+    avrdude_message(MSG_NOTICE, "%s: could not write configuration cache \"%s\"\n",
+                    progname, cachefile);
+  }
+  else {
+    avrdude_message(MSG_DEBUG, "%s: wrote configuration cache \"%s\"\n",
+                    progname, cachefile);
+  }
+
+  return 0;
+}
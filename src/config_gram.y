@@ -62,6 +62,7 @@ static int pin_name;
 %token K_WRITEPAGE
 %token K_CHIP_ERASE
 %token K_PGM_ENABLE
+%token K_POLL_READY
 
 %token K_MEMORY
 
@@ -640,7 +641,8 @@ opcode :
   K_LOAD_EXT_ADDR |
   K_WRITEPAGE    |
   K_CHIP_ERASE   |
-  K_PGM_ENABLE
+  K_PGM_ENABLE   |
+  K_POLL_READY
 ;
 
 
@@ -1491,6 +1493,7 @@ static int which_opcode(TOKEN * opcode)
     case K_WRITEPAGE   : return AVR_OP_WRITEPAGE; break;
     case K_CHIP_ERASE  : return AVR_OP_CHIP_ERASE; break;
     case K_PGM_ENABLE  : return AVR_OP_PGM_ENABLE; break;
+    case K_POLL_READY  : return AVR_OP_POLL_READY; break;
     default :
       yyerror("invalid opcode");
       return -1;
@@ -1509,7 +1512,9 @@ static int parse_cmdbits(OPCODE * op)
   int len;
   char * s, *brkt = NULL;
   int rv = 0;
+  CMDBIT bits[32];
 
+  memset(bits, 0, sizeof(bits));
   bitno = 32;
   while (lsize(string_list)) {
 
@@ -1538,34 +1543,34 @@ static int parse_cmdbits(OPCODE * op)
       if (len == 1) {
         switch (ch) {
           case '1':
-            op->bit[bitno].type  = AVR_CMDBIT_VALUE;
-            op->bit[bitno].value = 1;
-            op->bit[bitno].bitno = bitno % 8;
+            bits[bitno].type  = AVR_CMDBIT_VALUE;
+            bits[bitno].value = 1;
+            bits[bitno].bitno = bitno % 8;
             break;
           case '0':
-            op->bit[bitno].type  = AVR_CMDBIT_VALUE;
-            op->bit[bitno].value = 0;
-            op->bit[bitno].bitno = bitno % 8;
+            bits[bitno].type  = AVR_CMDBIT_VALUE;
+            bits[bitno].value = 0;
+            bits[bitno].bitno = bitno % 8;
             break;
           case 'x':
-            op->bit[bitno].type  = AVR_CMDBIT_IGNORE;
-            op->bit[bitno].value = 0;
-            op->bit[bitno].bitno = bitno % 8;
+            bits[bitno].type  = AVR_CMDBIT_IGNORE;
+            bits[bitno].value = 0;
+            bits[bitno].bitno = bitno % 8;
             break;
           case 'a':
-            op->bit[bitno].type  = AVR_CMDBIT_ADDRESS;
-            op->bit[bitno].value = 0;
-            op->bit[bitno].bitno = 8*(bitno/8) + bitno % 8;
+            bits[bitno].type  = AVR_CMDBIT_ADDRESS;
+            bits[bitno].value = 0;
+            bits[bitno].bitno = 8*(bitno/8) + bitno % 8;
             break;
           case 'i':
-            op->bit[bitno].type  = AVR_CMDBIT_INPUT;
-            op->bit[bitno].value = 0;
-            op->bit[bitno].bitno = bitno % 8;
+            bits[bitno].type  = AVR_CMDBIT_INPUT;
+            bits[bitno].value = 0;
+            bits[bitno].bitno = bitno % 8;
             break;
           case 'o':
-            op->bit[bitno].type  = AVR_CMDBIT_OUTPUT;
-            op->bit[bitno].value = 0;
-            op->bit[bitno].bitno = bitno % 8;
+            bits[bitno].type  = AVR_CMDBIT_OUTPUT;
+            bits[bitno].value = 0;
+            bits[bitno].bitno = bitno % 8;
             break;
           default :
             yyerror("invalid bit specifier '%c'", ch);
@@ -1576,14 +1581,14 @@ static int parse_cmdbits(OPCODE * op)
       else {
         if (ch == 'a') {
           q = &s[1];
-          op->bit[bitno].bitno = strtol(q, &e, 0);
+          bits[bitno].bitno = strtol(q, &e, 0);
           if ((e == q)||(*e != 0)) {
             yyerror("can't parse bit number from \"%s\"", q);
             rv = -1;
             break;
           }
-          op->bit[bitno].type = AVR_CMDBIT_ADDRESS;
-          op->bit[bitno].value = 0;
+          bits[bitno].type = AVR_CMDBIT_ADDRESS;
+          bits[bitno].value = 0;
         }
         else {
           yyerror("invalid bit specifier \"%s\"", s);
@@ -1599,5 +1604,10 @@ static int parse_cmdbits(OPCODE * op)
 
   }  /* while */
 
+  if (rv == 0 && avr_compile_opcode(op, bits) < 0) {
+    yyerror("can't compile instruction");
+    rv = -1;
+  }
+
   return rv;
 }
@@ -334,8 +334,8 @@ static int ihex2b(char * infile, FILE * inf,
         }
         for (i=0; i<ihex.reclen; i++) {
           mem->buf[nextaddr+i] = ihex.data[i];
-          mem->tags[nextaddr+i] = TAG_ALLOCATED;
         }
+        avr_mem_tag(mem, nextaddr, ihex.reclen);
         if (nextaddr+ihex.reclen > maxaddr)
           maxaddr = nextaddr+ihex.reclen;
         break;
@@ -675,8 +675,8 @@ static int srec2b(char * infile, FILE * inf,
       }
       for (i=0; i<srec.reclen; i++) {
         mem->buf[nextaddr+i] = srec.data[i];
-        mem->tags[nextaddr+i] = TAG_ALLOCATED;
       }
+      avr_mem_tag(mem, nextaddr, srec.reclen);
       if (nextaddr+srec.reclen > maxaddr)
         maxaddr = nextaddr+srec.reclen;
       reccount++;      
@@ -1011,7 +1011,7 @@ static int elf2b(char * infile, FILE * inf,
             avrdude_message(MSG_NOTICE2, "    Extracting one byte from file offset %d\n",
                             foff);
             mem->buf[0] = ((unsigned char *)d->d_buf)[foff];
-            mem->tags[0] = TAG_ALLOCATED;
+            avr_mem_tag(mem, 0, 1);
             rv = 1;
           }
         } else {
@@ -1023,7 +1023,7 @@ static int elf2b(char * infile, FILE * inf,
           avrdude_message(MSG_DEBUG, "    Writing %d bytes to mem offset 0x%x\n",
                           d->d_size, idx);
           memcpy(mem->buf + idx, d->d_buf, d->d_size);
-          memset(mem->tags + idx, TAG_ALLOCATED, d->d_size);
+          avr_mem_tag(mem, idx, d->d_size);
         }
       }
     }
@@ -1084,7 +1084,7 @@ static int fileio_rbin(struct fioparms * fio,
     case FIO_READ:
       rc = fread(buf, 1, size, f);
       if (rc > 0)
-        memset(mem->tags, TAG_ALLOCATED, rc);
+        avr_mem_tag(mem, 0, rc);
       break;
     case FIO_WRITE:
       rc = fwrite(buf, 1, size, f);
@@ -1130,7 +1130,7 @@ static int fileio_imm(struct fioparms * fio,
           return -1;
         }
         mem->buf[loc] = b;
-        mem->tags[loc++] = TAG_ALLOCATED;
+        avr_mem_tag(mem, loc++, 1);
         p = strtok(NULL, " ,");
         rc = loc;
       }
@@ -1474,7 +1474,7 @@ int fileio(int op, char * filename, FILEFMT format,
     /* 0xff fill unspecified memory */
     memset(mem->buf, 0xff, size);
   }
-  memset(mem->tags, 0, size);
+  avr_mem_untag_all(mem);
 
   using_stdio = 0;
 
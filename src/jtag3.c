@@ -1665,7 +1665,7 @@ static int jtag3_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   avrdude_message(MSG_NOTICE2, "%s: jtag3_page_erase(.., %s, 0x%x)\n",
 	    progname, m->desc, addr);
 
-  if (!(p->flags & AVRPART_HAS_PDI)) {
+  if (!(p->flags & (AVRPART_HAS_PDI | AVRPART_HAS_UPDI))) {
     avrdude_message(MSG_INFO, "%s: jtag3_page_erase: not an Xmega device\n",
 	    progname);
     return -1;
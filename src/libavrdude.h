@@ -42,6 +42,7 @@ typedef uint32_t pinmask_t;
 
 typedef void * LISTID;
 typedef void * LNODEID;
+typedef void * HASHID;
 
 
 /*----------------------------------------------------------------------
@@ -90,6 +91,7 @@ LNODEID    lnext  ( LNODEID ); /* next item in the list */
 LNODEID    lprev  ( LNODEID ); /* previous item in the list */
 void     * ldata  ( LNODEID ); /* data at the current position */
 int        lsize  ( LISTID  ); /* number of elements in the list */
+unsigned long lgen ( LISTID ); /* changes unless items are added at the ends */
 
 int        ladd     ( LISTID lid, void * p );
 int        laddo    ( LISTID lid, void *p, 
@@ -117,6 +119,11 @@ void     * lsrch   ( LISTID lid, void * p, int (*compare)(void *p1,void *p2));
 
 int        lprint  ( FILE * f, LISTID lid );
 
+HASHID     hcreat   ( void );
+void       hdestroy ( HASHID hid );
+void     * hget     ( HASHID hid, const void * key, size_t keylen );
+void    ** hslot    ( HASHID hid, const void * key, size_t keylen );
+
 #ifdef __cplusplus
 }
 #endif
@@ -139,6 +146,7 @@ enum {
   AVR_OP_WRITEPAGE,
   AVR_OP_CHIP_ERASE,
   AVR_OP_PGM_ENABLE,
+  AVR_OP_POLL_READY,
   AVR_OP_MAX
 };
 
@@ -171,8 +179,30 @@ typedef struct cmdbit {
   int          value; /* bit value if type == AVR_CMDBIT_VALUD */
 } CMDBIT;
 
+/*
+ * Compiled form of an instruction: the fixed bits as a value/mask pair,
+ * and the address, input and output bits as runs of command bits that
+ * map to contiguous operand bits, each moved into place with one shift.
+ * The 32 command bits are numbered as in the CMDBIT specs, bit 31 being
+ * the MSB of the first byte sent.
+ */
+#define AVR_OP_MAXRUNS 8
+
+enum {
+  AVR_OPRUN_ADDRESS,
+  AVR_OPRUN_INPUT,
+  AVR_OPRUN_OUTPUT,
+  AVR_OPRUN_MAX
+};
+
 typedef struct opcode {
-  CMDBIT        bit[32]; /* opcode bit specs */
+  unsigned int  value_mask;                 /* AVR_CMDBIT_VALUE bits */
+  unsigned int  value;                      /* their settings */
+  unsigned int  mask[AVR_OPRUN_MAX];        /* bits of each operand */
+  unsigned int  run_mask[AVR_OP_MAXRUNS];   /* command bits of each run */
+  signed char   run_shift[AVR_OP_MAXRUNS];  /* command bitno - operand bitno */
+  unsigned char run_end[AVR_OPRUN_MAX];     /* end of each operand's runs */
+  signed char   output_index;               /* cmd byte holding the output */
 } OPCODE;
 
 
@@ -199,8 +229,6 @@ typedef struct opcode {
 #define FLASH_INSTR_SIZE 3
 #define EEPROM_INSTR_SIZE 20
 
-#define TAG_ALLOCATED          1    /* memory byte is allocated */
-
 typedef struct avrpart {
   char          desc[AVR_DESCLEN];  /* long part name */
   char          id[AVR_IDLEN];      /* short part name */
@@ -264,10 +292,23 @@ typedef struct avrpart {
   OPCODE      * op[AVR_OP_MAX];     /* opcodes */
 
   LISTID        mem;                /* avr memory definitions */
+  HASHID        memidx;             /* index of mem for avr_locate_mem() */
+  unsigned long memidx_gen;         /* lgen(mem) when memidx was built */
+  LNODEID       memidx_first;       /* first and last mem indexed */
+  LNODEID       memidx_last;
   char          config_file[PATH_MAX]; /* config file where defined */
   int           lineno;                /* config file line number */
 } AVRPART;
 
+/*
+ * A contiguous range of memory bytes [start, end) that have been
+ * allocated, i. e. given a value by an input file or the user.
+ */
+typedef struct avrmem_extent {
+  unsigned int start;         /* first allocated byte */
+  unsigned int end;           /* one past the last allocated byte */
+} AVRMEM_EXTENT;
+
 #define AVR_MEMDESCLEN 64
 typedef struct avrmem {
   char desc[AVR_MEMDESCLEN];  /* memory description ("flash", "eeprom", etc) */
@@ -291,7 +332,10 @@ typedef struct avrmem {
   int pollindex;              /* stk500 v2 xml file parameter */
 
   unsigned char * buf;        /* pointer to memory buffer */
-  unsigned char * tags;       /* allocation tags */
+  AVRMEM_EXTENT * extents;    /* allocated ranges of buf, sorted by address,
+                                 neither overlapping nor adjacent */
+  int n_extents;              /* number of entries used in extents */
+  int max_extents;            /* number of entries allocated in extents */
   OPCODE * op[AVR_OP_MAX];    /* opcodes */
 } AVRMEM;
 
@@ -302,6 +346,8 @@ extern "C" {
 /* Functions for OPCODE structures */
 OPCODE * avr_new_opcode(void);
 void     avr_free_opcode(OPCODE * op);
+int avr_compile_opcode(OPCODE * op, const CMDBIT bits[32]);
+void avr_opcode_bit(const OPCODE * op, int bitno, CMDBIT * bit);
 int avr_set_bits(OPCODE * op, unsigned char * cmd);
 int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr);
 int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data);
@@ -313,7 +359,11 @@ AVRMEM * avr_new_memtype(void);
 int avr_initmem(AVRPART * p);
 AVRMEM * avr_dup_mem(AVRMEM * m);
 void     avr_free_mem(AVRMEM * m);
+void     avr_mem_tag(AVRMEM * m, unsigned int addr, unsigned int len);
+void     avr_mem_untag_all(AVRMEM * m);
+int      avr_mem_tagged(AVRMEM * m, unsigned int addr, unsigned int len);
 AVRMEM * avr_locate_mem(AVRPART * p, char * desc);
+int avr_mem_is_flash_type(AVRMEM * m);
 void avr_mem_display(const char * prefix, FILE * f, AVRMEM * m, int type,
                      int verbose);
 
@@ -588,14 +638,44 @@ extern struct serial_device usb_serdev_frame;
 extern struct serial_device avrdoper_serdev;
 extern struct serial_device usbhid_serdev;
 
-#define serial_open (serdev->open)
 #define serial_setparams (serdev->setparams)
 #define serial_close (serdev->close)
-#define serial_send (serdev->send)
-#define serial_recv (serdev->recv)
 #define serial_drain (serdev->drain)
 #define serial_set_dtr_rts (serdev->set_dtr_rts)
 
+/* traffic through serial_send() and serial_recv() */
+#define SERIAL_LATENCY_BUCKETS 24       /* 1 us ... 8 s, log2 scaled */
+
+struct serial_stats {
+  unsigned long sends;
+  unsigned long recvs;
+  unsigned long bytes_sent;
+  unsigned long bytes_received;
+  unsigned long timeouts;       /* failed receives */
+  unsigned long retries;        /* sends following a failed receive */
+  unsigned long round_trips;    /* sends answered by a receive */
+  unsigned long latency[SERIAL_LATENCY_BUCKETS]; /* send to receive, us */
+};
+
+extern struct serial_stats serial_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int serial_open(char * port, union pinfo pinfo, union filedescriptor *fd);
+int serial_send(union filedescriptor *fd, const unsigned char * buf, size_t buflen);
+int serial_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen);
+void serial_stats_reset(void);
+void serial_stats_report(void);
+unsigned long serial_latency_min(int bucket);
+int serial_capture_start(const char * spec);
+void serial_capture_end(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 /* formerly pgm.h */
 
 #define ON  1
@@ -653,6 +733,10 @@ typedef struct programmer_t {
   int ispdelay;    /* ISP clock delay */
   union filedescriptor fd;
   int  page_size;  /* page size if the programmer supports paged write/load */
+  int  erase_blanks; /* chip_erase leaves the flash reading all 0xff */
+  int  chip_erase_trips; /* link round trips of a chip_erase */
+  int  page_erase_trips; /* ... of a page_erase */
+  int  page_write_trips; /* ... of a paged_write of one page */
   int  (*rdy_led)        (struct programmer_t * pgm, int value);
   int  (*err_led)        (struct programmer_t * pgm, int value);
   int  (*pgm_led)        (struct programmer_t * pgm, int value);
@@ -689,6 +773,7 @@ typedef struct programmer_t {
                           unsigned long addr, unsigned char * value);
   int  (*read_sig_bytes) (struct programmer_t * pgm, AVRPART * p, AVRMEM * m);
   int  (*read_sib)       (struct programmer_t * pgm, AVRPART * p, char *sib);
+  int  (*verify_crc)     (struct programmer_t * pgm, AVRPART * p, AVRMEM * m);
   void (*print_parms)    (struct programmer_t * pgm);
   int  (*set_vtarget)    (struct programmer_t * pgm, double v);
   int  (*set_varef)      (struct programmer_t * pgm, unsigned int chan, double v);
@@ -743,6 +828,9 @@ void sort_programmers(LISTID programmers);
 
 typedef void (*FP_UpdateProgress)(int percent, double etime, char *hdr);
 
+typedef int (*FP_ReadPageCallback)(AVRMEM * mem, unsigned int addr,
+                                   unsigned int len, void * cookie);
+
 extern struct avrpart parts[];
 
 extern FP_UpdateProgress update_progress;
@@ -759,6 +847,11 @@ int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
 int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype, AVRPART * v);
 
+int avr_read_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, AVRMEM * vmem);
+
+int avr_read_mem_cb(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, AVRMEM * vmem,
+                    FP_ReadPageCallback cb, void * cookie);
+
 int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                    unsigned long addr);
 
@@ -771,10 +864,25 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
               int auto_erase);
 
+int avr_write_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m, int size,
+                  int auto_erase, int incremental, int erased,
+                  int * nskipped);
+
 int avr_signature(PROGRAMMER * pgm, AVRPART * p);
 
+int avr_tune_sck(PROGRAMMER * pgm, AVRPART * p, double hint, double * period);
+
+int avr_wait_ready(PROGRAMMER * pgm, AVRPART * p, unsigned int max_us);
+
+void avr_ready_report(void);
+
 int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size);
 
+int avr_verify_mem(AVRMEM * a, AVRMEM * b, int size);
+
+int avr_verify_stream(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                      AVRMEM * vmem, int size, int all, int * nbad);
+
 int avr_get_cycle_count(PROGRAMMER * pgm, AVRPART * p, int * cycles);
 
 int avr_put_cycle_count(PROGRAMMER * pgm, AVRPART * p, int cycles);
@@ -870,6 +978,15 @@ enum updateflags {
   UF_NONE = 0,
   UF_NOWRITE = 1,
   UF_AUTO_ERASE = 2,
+  UF_VERIFY_ALL = 4,
+  UF_INCREMENTAL = 8,
+  UF_CRC_VERIFY = 16,
+  UF_ERASED = 32,
+};
+
+enum erase_plan {
+  ERASE_PLAN_CHIP,
+  ERASE_PLAN_PAGE
 };
 
 
@@ -891,6 +1008,27 @@ extern UPDATE * new_update(int op, char * memtype, int filefmt,
 extern void free_update(UPDATE * upd);
 extern int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd,
 		 enum updateflags flags);
+extern int plan_erase(PROGRAMMER * pgm, struct avrpart * p, LISTID updates);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+/* timing.c */
+
+extern int timing_enabled;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+double timing_now(void);
+int timing_begin(const char * fmt, ...);
+void timing_count(long bytes, int pages);
+void timing_end(int handle);
+void timing_report(FILE * f, int json, const char * programmer,
+                   const char * part, const char * port);
 
 #ifdef __cplusplus
 }
@@ -945,6 +1083,8 @@ void cleanup_config(void);
 
 int read_config(const char * file);
 
+int read_config_cached(const char * file, const char * cachefile, int rebuild);
+
 #ifdef __cplusplus
 }
 #endif
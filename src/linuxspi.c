@@ -58,35 +58,81 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <sys/time.h>
 
 #define LINUXSPI "linuxspi"
 
+/*
+ * spidev rejects any message longer than its "bufsiz" module
+ * parameter; 4096 bytes is the kernel default.
+ */
+#define LINUXSPI_DEFAULT_BUFSIZ 4096
+#define LINUXSPI_BUFSIZ_PARAM "/sys/module/spidev/parameters/bufsiz"
+
 static int fd_spidev, fd_gpiochip, fd_linehandle;
+static unsigned int spi_bufsiz = LINUXSPI_DEFAULT_BUFSIZ;
 
 /**
  * @brief Sends/receives a message in full duplex mode
- * @return -1 on failure, otherwise number of bytes sent/received
+ *
+ * Buffers longer than the spidev bufsiz limit are split into as few
+ * ioctl() calls as possible.  The ISP protocol does not need any gap
+ * between consecutive 4-byte instructions, so a whole page worth of
+ * instructions is clocked out back to back.
+ *
+ * @return -1 on failure, otherwise 0
  */
 static int linuxspi_spi_duplex(PROGRAMMER *pgm, const unsigned char *tx, unsigned char *rx, int len)
 {
     struct spi_ioc_transfer tr;
-    int ret;
+    int ret, n;
+
+    while (len > 0) {
+        n = len > spi_bufsiz? spi_bufsiz: len;
+
+        tr = (struct spi_ioc_transfer) {
+            .tx_buf = (unsigned long)tx,
+            .rx_buf = (unsigned long)rx,
+            .len = n,
+            .delay_usecs = 1,
+            .speed_hz = 1.0 / pgm->bitclock, // seconds to Hz
+            .bits_per_word = 8,
+        };
+
+        ret = ioctl(fd_spidev, SPI_IOC_MESSAGE(1), &tr);
+        if (ret != n) {
+            avrdude_message(MSG_INFO, "\n%s: error: Unable to send SPI message\n", progname);
+            if (ret == -1)
+                return -1;
+        }
+
+        tx += n;
+        rx += n;
+        len -= n;
+    }
+
+    return 0;
+}
 
-    tr = (struct spi_ioc_transfer) {
-        .tx_buf = (unsigned long)tx,
-        .rx_buf = (unsigned long)rx,
-        .len = len,
-        .delay_usecs = 1,
-	.speed_hz = 1.0 / pgm->bitclock, // seconds to Hz
-        .bits_per_word = 8,
-    };
+/*
+ * Read the spidev transfer size limit, so paged accesses can be batched
+ * into as few ioctl() calls as the driver allows.
+ */
+static void linuxspi_get_bufsiz(void)
+{
+    FILE *f;
+    unsigned int bufsiz;
 
-    ret = ioctl(fd_spidev, SPI_IOC_MESSAGE(1), &tr);
-    if (ret != len)
-        avrdude_message(MSG_INFO, "\n%s: error: Unable to send SPI message\n", progname);
+    spi_bufsiz = LINUXSPI_DEFAULT_BUFSIZ;
+    if ((f = fopen(LINUXSPI_BUFSIZ_PARAM, "r")) == NULL)
+        return;
+    if (fscanf(f, "%u", &bufsiz) == 1 && bufsiz >= 4)
+        spi_bufsiz = bufsiz & ~3u; // never split an instruction
+    fclose(f);
 
-    return (ret == -1) ? -1 : 0;
+    avrdude_message(MSG_DEBUG, "%s: spidev bufsiz is %u bytes\n", progname, spi_bufsiz);
 }
 
 static void linuxspi_setup(PROGRAMMER *pgm)
@@ -166,6 +212,8 @@ static int linuxspi_open(PROGRAMMER *pgm, char *port)
         return -1;
     }
 
+    linuxspi_get_bufsiz();
+
     uint32_t mode = SPI_MODE_0 | SPI_NO_CS;
     ret = ioctl(fd_spidev, SPI_IOC_WR_MODE32, &mode);
     if (ret == -1) {
@@ -361,12 +409,222 @@ static int linuxspi_chip_erase(PROGRAMMER *pgm, AVRPART *p)
     memset(cmd, 0, sizeof(cmd));
     avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
     pgm->cmd(pgm, cmd, res);
-    usleep(p->chip_erase_delay);
+    avr_wait_ready(pgm, p, p->chip_erase_delay);
     pgm->initialize(pgm, p);
 
     return 0;
 }
 
+/*
+ * Select the read or load opcode for byte address addr.  Memories that
+ * come with a _LO/_HI opcode pair are word addressed.
+ */
+static OPCODE *linuxspi_opcode(AVRMEM *m, int op_lo, int op_hi, int op_byte,
+                               unsigned int addr, unsigned long *caddr)
+{
+    if (m->op[op_lo] && m->op[op_hi]) {
+        *caddr = addr / 2;
+        return m->op[(addr & 1)? op_hi: op_lo];
+    }
+
+    *caddr = addr;
+    return op_byte < 0? m->op[op_lo]: m->op[op_byte];
+}
+
+/*
+ * Append one ISP instruction to a command buffer, returning the number
+ * of bytes added.
+ */
+static int linuxspi_put_cmd(OPCODE *op, unsigned char *cmd, unsigned long addr,
+                            int has_input, unsigned char data)
+{
+    memset(cmd, 0, 4);
+    avr_set_bits(op, cmd);
+    avr_set_addr(op, cmd, addr);
+    if (has_input)
+        avr_set_input(op, cmd, data);
+
+    return 4;
+}
+
+/*
+ * Wait for a page commit to complete.  While the NVM is busy, reading
+ * back any location of the page yields 0xff, so poll the last byte
+ * whose programmed value differs from that until it reads back correct
+ * or max_write_delay has expired.  Pages without such a byte get the
+ * full datasheet delay instead.
+ */
+static void linuxspi_page_poll(PROGRAMMER *pgm, AVRMEM *m,
+                               unsigned int addr, unsigned int n_bytes)
+{
+    unsigned char cmd[8], res[8], data;
+    unsigned long caddr;
+    unsigned int i, poll_addr;
+    unsigned long start_time, now;
+    struct timeval tv;
+    OPCODE *readop;
+    int len;
+
+    for (i = n_bytes, poll_addr = UINT_MAX; i > 0; i--) {
+        data = m->buf[addr + i - 1];
+        if (data != 0xff && data != m->readback[0] && data != m->readback[1]) {
+            poll_addr = addr + i - 1;
+            break;
+        }
+    }
+
+    readop = NULL;
+    if (poll_addr != UINT_MAX)
+        readop = linuxspi_opcode(m, AVR_OP_READ_LO, AVR_OP_READ_HI, AVR_OP_READ,
+                                 poll_addr, &caddr);
+    if (readop == NULL) {
+        usleep(m->max_write_delay);
+        return;
+    }
+
+    /* load extended address must precede every read on large parts */
+    len = 0;
+    if (m->op[AVR_OP_LOAD_EXT_ADDR])
+        len += linuxspi_put_cmd(m->op[AVR_OP_LOAD_EXT_ADDR], cmd, caddr, 0, 0);
+    linuxspi_put_cmd(readop, cmd + len, caddr, 0, 0);
+    len += 4;
+
+    gettimeofday(&tv, NULL);
+    start_time = (tv.tv_sec * 1000000) + tv.tv_usec;
+    do {
+        if (linuxspi_spi_duplex(pgm, cmd, res, len) < 0)
+            return;
+        data = 0;
+        avr_get_output(readop, res + len - 4, &data);
+        if (data == m->buf[poll_addr])
+            return;
+        gettimeofday(&tv, NULL);
+        now = (tv.tv_sec * 1000000) + tv.tv_usec;
+    } while (now - start_time < m->max_write_delay);
+
+    avrdude_message(MSG_DEBUG, "%s: linuxspi_page_poll(): %s address 0x%04x still busy "
+                    "after %d us\n", progname, m->desc, poll_addr, m->max_write_delay);
+}
+
+/*
+ * Load a whole page into the page buffer and commit it, sending all
+ * LOADPAGE instructions and the WRITEPAGE instruction in one batch.
+ * Memories without page mode instructions are written byte by byte.
+ */
+static int linuxspi_paged_write(PROGRAMMER *pgm, AVRPART *p, AVRMEM *m,
+                                unsigned int page_size, unsigned int addr,
+                                unsigned int n_bytes)
+{
+    OPCODE *op, *wp = m->op[AVR_OP_WRITEPAGE], *lext = m->op[AVR_OP_LOAD_EXT_ADDR];
+    unsigned char *cmd;
+    unsigned long caddr;
+    unsigned int i;
+    int len, rc;
+
+    if (addr + n_bytes > m->size)
+        n_bytes = m->size - addr;
+
+    if (m->op[AVR_OP_LOADPAGE_LO] == NULL || wp == NULL) {
+        if (m->op[AVR_OP_WRITE] == NULL && m->op[AVR_OP_WRITE_LO] == NULL)
+            return -2;
+        for (i = 0; i < n_bytes; i++)
+            if (avr_write_byte_default(pgm, p, m, addr + i, m->buf[addr + i]) != 0)
+                return -2;
+        return n_bytes;
+    }
+
+    if ((cmd = malloc(4 * (n_bytes + 2))) == NULL) {
+        avrdude_message(MSG_INFO, "%s: linuxspi_paged_write(): out of memory\n", progname);
+        return -1;
+    }
+
+    pgm->pgm_led(pgm, ON);
+    pgm->err_led(pgm, OFF);
+
+    len = 0;
+    for (i = 0; i < n_bytes; i++) {
+        op = linuxspi_opcode(m, AVR_OP_LOADPAGE_LO, AVR_OP_LOADPAGE_HI, -1, addr + i, &caddr);
+        len += linuxspi_put_cmd(op, cmd + len, caddr, 1, m->buf[addr + i]);
+    }
+
+    linuxspi_opcode(m, AVR_OP_LOADPAGE_LO, AVR_OP_LOADPAGE_HI, -1, addr, &caddr);
+    if (lext)
+        len += linuxspi_put_cmd(lext, cmd + len, caddr, 0, 0);
+    len += linuxspi_put_cmd(wp, cmd + len, caddr, 0, 0);
+
+    rc = linuxspi_spi_duplex(pgm, cmd, cmd, len);
+    free(cmd);
+    if (rc < 0) {
+        pgm->err_led(pgm, ON);
+        pgm->pgm_led(pgm, OFF);
+        return -1;
+    }
+
+    linuxspi_page_poll(pgm, m, addr, n_bytes);
+
+    pgm->pgm_led(pgm, OFF);
+
+    return n_bytes;
+}
+
+/*
+ * Read a page worth of memory, sending all READ instructions in one
+ * batch and collecting the results from the clocked-in stream.
+ */
+static int linuxspi_paged_load(PROGRAMMER *pgm, AVRPART *p, AVRMEM *m,
+                               unsigned int page_size, unsigned int addr,
+                               unsigned int n_bytes)
+{
+    OPCODE *op, *lext = m->op[AVR_OP_LOAD_EXT_ADDR];
+    unsigned char *cmd;
+    unsigned long caddr;
+    unsigned int i;
+    int len, off, rc;
+
+    if (addr + n_bytes > m->size)
+        n_bytes = m->size - addr;
+
+    if (m->op[AVR_OP_READ] == NULL && m->op[AVR_OP_READ_LO] == NULL)
+        return -2;
+
+    if ((cmd = malloc(4 * (n_bytes + 1))) == NULL) {
+        avrdude_message(MSG_INFO, "%s: linuxspi_paged_load(): out of memory\n", progname);
+        return -1;
+    }
+
+    len = 0;
+    if (lext) {
+        linuxspi_opcode(m, AVR_OP_READ_LO, AVR_OP_READ_HI, AVR_OP_READ, addr, &caddr);
+        len += linuxspi_put_cmd(lext, cmd, caddr, 0, 0);
+    }
+    off = len;
+    for (i = 0; i < n_bytes; i++) {
+        op = linuxspi_opcode(m, AVR_OP_READ_LO, AVR_OP_READ_HI, AVR_OP_READ, addr + i, &caddr);
+        if (op == NULL) {
+            free(cmd);
+            return -2;
+        }
+        len += linuxspi_put_cmd(op, cmd + len, caddr, 0, 0);
+    }
+
+    pgm->pgm_led(pgm, ON);
+    rc = linuxspi_spi_duplex(pgm, cmd, cmd, len);
+    pgm->pgm_led(pgm, OFF);
+    if (rc < 0) {
+        free(cmd);
+        return -1;
+    }
+
+    for (i = 0; i < n_bytes; i++) {
+        op = linuxspi_opcode(m, AVR_OP_READ_LO, AVR_OP_READ_HI, AVR_OP_READ, addr + i, &caddr);
+        m->buf[addr + i] = 0;
+        avr_get_output(op, cmd + off + 4 * i, &m->buf[addr + i]);
+    }
+    free(cmd);
+
+    return n_bytes;
+}
+
 static int linuxspi_parseexitspecs(PROGRAMMER *pgm, char *s)
 {
     char *cp;
@@ -407,6 +665,8 @@ void linuxspi_initpgm(PROGRAMMER *pgm)
     pgm->write_byte     = avr_write_byte_default;
 
     /* optional functions */
+    pgm->paged_write    = linuxspi_paged_write;
+    pgm->paged_load     = linuxspi_paged_load;
     pgm->setup          = linuxspi_setup;
     pgm->teardown       = linuxspi_teardown;
     pgm->parseexitspecs = linuxspi_parseexitspecs;
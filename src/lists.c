@@ -39,6 +39,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libavrdude.h"
 
@@ -88,6 +89,7 @@ typedef struct LIST {
   unsigned int magic1;
 #endif
   int        num;           /* number of elements in the list    */
+  unsigned long gen;        /* generation, changes on every update */
   short int  free_on_close; /* free the LIST memory on close T/F */
   short int  poolsize;      /* list node allocation size         */
   int        n_ln_pool;     /* number of listnodes in a pool     */
@@ -128,6 +130,9 @@ typedef struct LIST {
 
 static int insert_ln ( LIST * l, LISTNODE * ln, void * data_ptr );
 
+/* source of list generation numbers, see lgen() */
+static unsigned long list_gen;
+
 
 #if CHECK_MAGIC
 static int cknpmagic ( LIST * l )
@@ -439,6 +444,7 @@ lcreat ( void * liststruct, int elements )
   l->top = NULL;
   l->bottom = NULL;
   l->num = 0;
+  l->gen = ++list_gen;
 
   if (elements == 0) {
     l->poolsize = DEFAULT_POOLSIZE;
@@ -734,6 +740,26 @@ lsize ( LISTID lid )
 
 
 
+/*------------------------------------------------------------
+|  lgen
+|
+|  list generation - return a number that changes whenever the
+|  list is modified other than by adding an item at its head or
+|  tail, and is never shared by two lists.  Useful to validate
+|  data derived from the list contents: while the generation
+|  stays the same, the items seen before are still there in the
+|  same order, and new ones can be found from the old lfirst()
+|  and llast() nodes.
+ ------------------------------------------------------------*/
+unsigned long
+lgen ( LISTID lid )
+{
+  CKLMAGIC(((LIST *)lid));
+  return ((LIST *)lid)->gen;
+}
+
+
+
 /*------------------------------------------------------------
 |  lcat
 |
@@ -925,6 +951,7 @@ insert_ln ( LIST * l, LISTNODE * ln, void * data_ptr )
     lnptr->prev = ln->prev;
     lnptr->next->prev = lnptr;
     lnptr->prev->next = lnptr;
+    l->gen = ++list_gen;
   }
 
   l->num++;
@@ -1093,6 +1120,7 @@ remove_ln ( LIST * l, LISTNODE * ln )
   |  adjust the item count of the list
    ------------------------------------*/
   l->num--;
+  l->gen = ++list_gen;
 
   CKLMAGIC(l);
 
@@ -1308,6 +1336,7 @@ lsort ( LISTID lid, int (* compare)(void * p1, void * p2) )
         ln->data = lt->data;
         lt->data = p;
         unsorted = 1;
+        l->gen = ++list_gen;
       }
       lt = ln;
     }
@@ -1405,3 +1434,181 @@ int lprint ( FILE * f, LISTID lid )
 
   return 0;
 }
+
+
+
+/*----------------------------------------------------------------------
+  General purpose hash table routines.  Entries are keyed by an
+  arbitrary byte string and hold a single data pointer.  The table
+  grows as needed, there is no removal of single entries.
+  ----------------------------------------------------------------------*/
+
+typedef struct HASHENT {
+  struct HASHENT * next;   /* chain to next entry in the bucket */
+  void           * data;   /* pointer to user data */
+  size_t           keylen; /* length of key */
+  unsigned char    key[];  /* key bytes */
+} HASHENT;
+
+
+typedef struct HASH {
+  unsigned int  nbuckets;  /* number of buckets, power of two */
+  unsigned int  num;       /* number of entries in the table */
+  HASHENT    ** bucket;    /* bucket array */
+} HASH;
+
+
+#define HASH_INITSIZE 64
+
+
+static unsigned int hash_key ( const void * key, size_t keylen )
+{
+  const unsigned char * k = key;
+  unsigned int h = 2166136261U;
+
+  while (keylen--) {
+    h ^= *k++;
+    h *= 16777619U;
+  }
+
+  return h;
+}
+
+
+static int hash_grow ( HASH * h )
+{
+  HASHENT ** nb, * e, * next;
+  unsigned int n, i, b;
+
+  n = h->nbuckets * 2;
+  nb = calloc(n, sizeof(*nb));
+  if (nb == NULL)
+    return -1;
+
+  for (i = 0; i < h->nbuckets; i++) {
+    for (e = h->bucket[i]; e; e = next) {
+      next = e->next;
+      b = hash_key(e->key, e->keylen) & (n - 1);
+      e->next = nb[b];
+      nb[b] = e;
+    }
+  }
+
+  FREE(h->bucket);
+  h->bucket = nb;
+  h->nbuckets = n;
+
+  return 0;
+}
+
+
+/*----------------------------------------------------------------------
+|  hcreat
+|
+|  create a new, empty hash table
+ ----------------------------------------------------------------------*/
+HASHID
+hcreat ( void )
+{
+  HASH * h;
+
+  h = (HASH *) MALLOC ( sizeof(HASH), "hash struct" );
+  if (h == NULL)
+    return NULL;
+
+  h->nbuckets = HASH_INITSIZE;
+  h->num = 0;
+  h->bucket = calloc(h->nbuckets, sizeof(*h->bucket));
+  if (h->bucket == NULL) {
+    FREE(h);
+    return NULL;
+  }
+
+  return h;
+}
+
+
+/*----------------------------------------------------------------------
+|  hdestroy
+|
+|  destroy a hash table, the user data is not touched
+ ----------------------------------------------------------------------*/
+void
+hdestroy ( HASHID hid )
+{
+  HASH * h = hid;
+  HASHENT * e, * next;
+  unsigned int i;
+
+  if (h == NULL)
+    return;
+
+  for (i = 0; i < h->nbuckets; i++) {
+    for (e = h->bucket[i]; e; e = next) {
+      next = e->next;
+      FREE(e);
+    }
+  }
+
+  FREE(h->bucket);
+  FREE(h);
+}
+
+
+/*----------------------------------------------------------------------
+|  hget
+|
+|  return the data stored under 'key', NULL if there is none
+ ----------------------------------------------------------------------*/
+void *
+hget ( HASHID hid, const void * key, size_t keylen )
+{
+  HASH * h = hid;
+  HASHENT * e;
+
+  e = h->bucket[hash_key(key, keylen) & (h->nbuckets - 1)];
+  for (; e; e = e->next) {
+    if (e->keylen == keylen && memcmp(e->key, key, keylen) == 0)
+      return e->data;
+  }
+
+  return NULL;
+}
+
+
+/*----------------------------------------------------------------------
+|  hslot
+|
+|  return a pointer to the data slot for 'key', creating a new entry
+|  (with its data set to NULL) if there is none yet.  Returns NULL if
+|  out of memory.
+ ----------------------------------------------------------------------*/
+void **
+hslot ( HASHID hid, const void * key, size_t keylen )
+{
+  HASH * h = hid;
+  HASHENT * e;
+  unsigned int b;
+
+  b = hash_key(key, keylen) & (h->nbuckets - 1);
+  for (e = h->bucket[b]; e; e = e->next) {
+    if (e->keylen == keylen && memcmp(e->key, key, keylen) == 0)
+      return &e->data;
+  }
+
+  if (h->num >= h->nbuckets && hash_grow(h) == 0)
+    b = hash_key(key, keylen) & (h->nbuckets - 1);
+
+  e = (HASHENT *) MALLOC ( sizeof(HASHENT) + keylen, "hash entry" );
+  if (e == NULL)
+    return NULL;
+
+  memcpy(e->key, key, keylen);
+  e->keylen = keylen;
+  e->data = NULL;
+  e->next = h->bucket[b];
+  h->bucket[b] = e;
+  h->num++;
+
+  return &e->data;
+}
@@ -45,6 +45,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#if !defined(WIN32)
+#include <sys/wait.h>
+#endif
 
 #include "avrdude.h"
 #include "libavrdude.h"
@@ -85,6 +88,8 @@ static LISTID extended_params = NULL;
 
 static LISTID additional_config_files = NULL;
 
+static LISTID ports = NULL;
+
 static PROGRAMMER * pgm;
 
 /*
@@ -108,11 +113,19 @@ static void usage(void)
  "  -p <partno>                Required. Specify AVR device.\n"
  "  -b <baudrate>              Override RS-232 baud rate.\n"
  "  -B <bitclock>              Specify JTAG/STK500v2 bit clock period (us).\n"
+ "  -B auto                    Find the fastest reliable bit clock.\n"
  "  -C <config-file>           Specify location of configuration file.\n"
+ "  -k                         Rebuild the configuration file cache.\n"
  "  -c <programmer>            Specify programmer type.\n"
  "  -D                         Disable auto erase for flash memory\n"
+ "  -I                         Incremental mode: only write pages which differ\n"
+ "                             from the device contents.\n"
+ "  -R                         Verify by a device-side CRC where supported.\n"
+ "  -M                         Continue verification after a mismatch, and\n"
+ "                             report all mismatching address ranges.\n"
  "  -i <delay>                 ISP Clock Delay [in microseconds]\n"
- "  -P <port>                  Specify connection port.\n"
+ "  -P <port>                  Specify connection port. Multiple -P options\n"
+ "                             program several targets in parallel.\n"
  "  -F                         Override invalid signature check.\n"
  "  -e                         Perform a chip erase.\n"
  "  -O                         Perform RC oscillator calibration (see AVR053). \n"
@@ -125,7 +138,11 @@ static void usage(void)
  "  -u                         Disable safemode, default when running from a script.\n"
  "  -s                         Silent safemode operation, will not ask you if\n"
  "                             fuses should be changed back.\n"
+ "  -S record:<file>           Record the serial traffic to <file>.\n"
+ "  -S replay:<file>[:<scale>] Play back recorded traffic instead of talking\n"
+ "                             to the programmer, scaling its latency.\n"
  "  -t                         Enter terminal mode.\n"
+ "  -T text|json[:<file>]      Report the time spent in each phase.\n"
  "  -E <exitspec>[,<exitspec>] List programmer exit specifications.\n"
  "  -x <extended_param>        Pass <extended_param> to programmer.\n"
  "  -v                         Verbose output. -v -v for more.\n"
@@ -298,10 +315,226 @@ static void cleanup_main(void)
         ldestroy(additional_config_files);
         additional_config_files = NULL;
     }
+    if (ports) {
+        ldestroy(ports);
+        ports = NULL;
+    }
 
     cleanup_config();
 }
 
+#if !defined(WIN32)
+/*
+ * Run the same session against several ports at once, using one child
+ * process per port.  All children share the configuration that has
+ * already been parsed, but each has its own programmer state.
+ *
+ * Returns the port to work on in a child.  In the parent, waits for all
+ * children, prints a per-target summary, stores the overall result in
+ * *exitrc and returns NULL.
+ */
+static char * fork_targets(LISTID ports, int * exitrc)
+{
+  struct target {
+    char * port;
+    pid_t pid;
+    int status;
+    struct timeval start, end;
+  } * targets;
+  static char childname[PATH_MAX];
+  int ntargets, nrunning, i, status;
+  struct timeval tv;
+  LNODEID ln;
+  pid_t pid;
+
+  ntargets = lsize(ports);
+  targets = calloc(ntargets, sizeof(*targets));
+  if (targets == NULL) {
+    avrdude_message(MSG_INFO, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  if (quell_progress < 2) {
+    avrdude_message(MSG_INFO, "%s: programming %d targets in parallel\n",
+                    progname, ntargets);
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (ln = lfirst(ports), i = 0; ln; ln = lnext(ln), i++) {
+    targets[i].port = ldata(ln);
+    gettimeofday(&targets[i].start, NULL);
+    pid = fork();
+    if (pid < 0) {
+      avrdude_message(MSG_INFO, "%s: cannot start session for port %s: %s\n",
+                      progname, targets[i].port, strerror(errno));
+      targets[i].status = -1;
+      continue;
+    }
+    if (pid == 0) {
+      char * port = targets[i].port;
+
+      /* tag every message with the port it belongs to */
+      snprintf(childname, sizeof(childname), "%s[%s]", progname, port);
+      progname = childname;
+      i = strlen(progname) + 2;
+      if (i > PATH_MAX - 1)
+        i = PATH_MAX - 1;
+      memset(progbuf, ' ', i);
+      progbuf[i] = 0;
+
+      /* progress bars of concurrent sessions would garble each other */
+      update_progress = NULL;
+
+      free(targets);
+      return port;
+    }
+    targets[i].pid = pid;
+  }
+
+  for (nrunning = 0, i = 0; i < ntargets; i++)
+    if (targets[i].pid > 0)
+      nrunning++;
+
+  while (nrunning > 0) {
+    pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < ntargets; i++) {
+      if (targets[i].pid == pid) {
+        targets[i].status = status;
+        targets[i].end = tv;
+        nrunning--;
+        break;
+      }
+    }
+  }
+
+  *exitrc = 0;
+  avrdude_message(MSG_INFO, "\n%s: summary of %d targets:\n", progname, ntargets);
+  for (i = 0; i < ntargets; i++) {
+    int ok = targets[i].pid > 0 &&
+      WIFEXITED(targets[i].status) && WEXITSTATUS(targets[i].status) == 0;
+    double t = (targets[i].end.tv_sec - targets[i].start.tv_sec) +
+      (targets[i].end.tv_usec - targets[i].start.tv_usec) / 1e6;
+
+    if (!ok)
+      *exitrc = 1;
+    if (targets[i].pid <= 0) {
+      avrdude_message(MSG_INFO, "%s%-24s not started\n", progbuf, targets[i].port);
+    } else if (WIFEXITED(targets[i].status)) {
+      avrdude_message(MSG_INFO, "%s%-24s %-7s %8.2f s (exit code %d)\n",
+                      progbuf, targets[i].port, ok? "OK": "FAILED", t,
+                      WEXITSTATUS(targets[i].status));
+    } else {
+      avrdude_message(MSG_INFO, "%s%-24s %-7s %8.2f s (killed by signal %d)\n",
+                      progbuf, targets[i].port, "FAILED", t,
+                      WIFSIGNALED(targets[i].status)? WTERMSIG(targets[i].status): 0);
+    }
+  }
+
+  free(targets);
+  return NULL;
+}
+#endif
+
+
+/*
+ * The SCK period found by -B auto is remembered per programmer and
+ * part in a small text file, one "<programmer> <part> <period>" line
+ * per pair.
+ */
+static double sck_cache_lookup(const char * file, const char * pgmid,
+                               const char * partid)
+{
+  FILE * f;
+  char line[256], id1[128], id2[128];
+  double period, found = 0.0;
+
+  if (file[0] == 0 || (f = fopen(file, "r")) == NULL)
+    return 0.0;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%127s %127s %lf", id1, id2, &period) == 3 &&
+        strcmp(id1, pgmid) == 0 && strcmp(id2, partid) == 0)
+      found = period;
+  }
+  fclose(f);
+
+  return found;
+}
+
+static void sck_cache_store(const char * file, const char * pgmid,
+                            const char * partid, double period)
+{
+  FILE * f, * t;
+  char line[256], id1[128], id2[128], tmpname[PATH_MAX];
+
+  /* one temporary file per process, parallel runs may store at once */
+  if (file[0] == 0 ||
+      snprintf(tmpname, sizeof(tmpname), "%s.%ld.tmp", file,
+               (long) getpid()) >= (int) sizeof(tmpname))
+    return;
+  if ((t = fopen(tmpname, "w")) == NULL) {
+    avrdude_message(MSG_NOTICE, "%s: can't write SCK cache \"%s\": %s\n",
+                    progname, tmpname, strerror(errno));
+    return;
+  }
+
+  /* copy all other entries */
+  if ((f = fopen(file, "r")) != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "%127s %127s", id1, id2) == 2 &&
+          strcmp(id1, pgmid) == 0 && strcmp(id2, partid) == 0)
+        continue;
+      fputs(line, t);
+    }
+    fclose(f);
+  }
+  fprintf(t, "%s %s %g\n", pgmid, partid, period);
+
+  if (fclose(t) != 0 || rename(tmpname, file) != 0) {
+    avrdude_message(MSG_NOTICE, "%s: can't write SCK cache \"%s\": %s\n",
+                    progname, file, strerror(errno));
+    unlink(tmpname);
+  }
+}
+
+/*
+ * -B auto: pick the fastest SCK clock that reads the target reliably,
+ * starting from the cached period of an earlier run if there is one.
+ */
+static void auto_bitclock(PROGRAMMER * pgm, AVRPART * p, const char * cachefile)
+{
+  const char * pgmid = ldata(lfirst(pgm->id));
+  double cached, period;
+
+  if (pgm->set_sck_period == NULL) {
+    avrdude_message(MSG_INFO, "%s: the %s programmer cannot set the SCK period, "
+                    "ignoring -B auto\n", progname, pgm->type);
+    return;
+  }
+
+  cached = sck_cache_lookup(cachefile, pgmid, p->id);
+  if (avr_tune_sck(pgm, p, cached, &period) < 0) {
+    avrdude_message(MSG_INFO, "%s: SCK auto-tuning failed\n", progname);
+    return;
+  }
+
+  if (quell_progress < 2) {
+    avrdude_message(MSG_INFO, "%s: using SCK period of %g us (%g kHz)%s\n",
+                    progname, period, 1e3 / period,
+                    period == cached? " from cache": "");
+  }
+  if (period != cached)
+    sck_cache_store(cachefile, pgmid, p->id, period);
+}
+
 static void replace_backslashes(char *s)
 {
   // Replace all backslashes with forward slashes
@@ -319,7 +552,7 @@ static void replace_backslashes(char *s)
 int main(int argc, char * argv [])
 {
   int              rc;          /* general return code checking */
-  int              exitrc;      /* exit code for main() */
+  int              exitrc = 0;  /* exit code for main() */
   int              i;           /* general loop counter */
   int              ch;          /* options flag */
   int              len;         /* length for various strings */
@@ -341,6 +574,9 @@ int main(int argc, char * argv [])
   char  * partdesc;    /* part id */
   char    sys_config[PATH_MAX]; /* system wide config file */
   char    usr_config[PATH_MAX]; /* per-user config file */
+  char    usr_cache[PATH_MAX]; /* per-user config cache file */
+  char    usr_sck_cache[PATH_MAX]; /* per-user SCK period cache file */
+  int     rebuild_cache; /* 1=reparse the system config, 0=use cache */
   char    executable_abspath[PATH_MAX]; /* absolute path to avrdude executable */
   char    executable_dirpath[PATH_MAX]; /* absolute path to folder with executable */
   bool    executable_abspath_found = false; /* absolute path to executable found */
@@ -348,13 +584,19 @@ int main(int argc, char * argv [])
   char  * e;           /* for strtol() error checking */
   int     baudrate;    /* override default programmer baud rate */
   double  bitclock;    /* Specify programmer bit clock (JTAG ICE) */
+  int     bitclock_auto; /* 1=find the fastest working SCK clock */
   int     ispdelay;    /* Specify the delay for ISP clock */
   int     safemode;    /* Enable safemode, 1=safemode on, 0=normal */
   int     silentsafe;  /* Don't ask about fuses, 1=silent, 0=normal */
   int     init_ok;     /* Device initialization worked well */
   int     is_open;     /* Device open succeeded */
   char  * logfile;     /* Use logfile rather than stderr for diagnostics */
+  int     timing_json; /* 1=report phase timing as JSON, 0=as text */
+  char  * timing_file; /* append the JSON timing report here, not stdout */
+  int     phase;       /* handle of the phase being timed */
+  char  * capture;     /* record:<file> or replay:<file>[:<scale>] */
   enum updateflags uflags = UF_AUTO_ERASE; /* Flags for do_op() */
+  int     erase_plan = -1; /* Erase strategy picked by plan_erase() */
   unsigned char safemode_lfuse = 0xff;
   unsigned char safemode_hfuse = 0xff;
   unsigned char safemode_efuse = 0xff;
@@ -374,6 +616,8 @@ int main(int argc, char * argv [])
   setvbuf(stderr, (char*)NULL, _IOLBF, 0);
 
   sys_config[0] = '\0';
+  usr_cache[0] = '\0';
+  usr_sck_cache[0] = '\0';
 
   progname = strrchr(argv[0],'/');
 
@@ -414,6 +658,12 @@ int main(int argc, char * argv [])
     exit(1);
   }
 
+  ports = lcreat(NULL, 0);
+  if (ports == NULL) {
+    avrdude_message(MSG_INFO, "%s: cannot initialize port list\n", progname);
+    exit(1);
+  }
+
   partdesc      = NULL;
   port          = NULL;
   erase         = 0;
@@ -429,11 +679,16 @@ int main(int argc, char * argv [])
   verbose       = 0;
   baudrate      = 0;
   bitclock      = 0.0;
+  bitclock_auto = 0;
   ispdelay      = 0;
+  rebuild_cache = 0;
   safemode      = 1;       /* Safemode on by default */
   silentsafe    = 0;       /* Ask by default */
   is_open       = 0;
   logfile       = NULL;
+  timing_json   = 0;
+  timing_file   = NULL;
+  capture       = NULL;
 
   len = strlen(progname) + 2;
   for (i=0; i<len; i++)
@@ -452,7 +707,7 @@ int main(int argc, char * argv [])
   /*
    * process command line arguments
    */
-  while ((ch = getopt(argc,argv,"?b:B:c:C:DeE:Fi:l:np:OP:qstU:uvVx:yY:")) != -1) {
+  while ((ch = getopt(argc,argv,"?b:B:c:C:DeE:Fi:Ikl:Mnp:OP:qRsS:tT:U:uvVx:yY:")) != -1) {
 
     switch (ch) {
       case 'b': /* override default programmer baud rate */
@@ -465,6 +720,10 @@ int main(int argc, char * argv [])
         break;
 
       case 'B':	/* specify JTAG ICE bit clock period */
+	if (strcmp(optarg, "auto") == 0) {
+	  bitclock_auto = 1;
+	  break;
+	}
 	bitclock = strtod(optarg, &e);
 	if (*e != 0) {
 	  /* trailing unit of measure present */
@@ -527,6 +786,10 @@ int main(int argc, char * argv [])
         programmer = optarg;
         break;
 
+      case 'k': /* rebuild configuration file cache */
+        rebuild_cache = 1;
+        break;
+
       case 'C': /* system wide configuration file */
         if (optarg[0] == '+') {
           ladd(additional_config_files, optarg+1);
@@ -557,6 +820,18 @@ int main(int argc, char * argv [])
 	logfile = optarg;
 	break;
 
+      case 'I': /* incremental mode */
+        uflags |= UF_INCREMENTAL;
+        break;
+
+      case 'R': /* CRC verify */
+        uflags |= UF_CRC_VERIFY;
+        break;
+
+      case 'M': /* report all verification mismatches */
+        uflags |= UF_VERIFY_ALL;
+        break;
+
       case 'n':
         uflags |= UF_NOWRITE;
         break;
@@ -571,6 +846,7 @@ int main(int argc, char * argv [])
 
       case 'P':
         port = optarg;
+        ladd(ports, optarg);
         break;
 
       case 'q' : /* Quell progress output */
@@ -582,10 +858,30 @@ int main(int argc, char * argv [])
         safemode = 1;
         break;
         
+      case 'S': /* record or replay the serial traffic */
+        capture = optarg;
+        break;
+
       case 't': /* enter terminal mode */
         terminal = 1;
         break;
 
+      case 'T': /* report the time spent in each phase */
+        if (strcmp(optarg, "text") == 0) {
+          timing_json = 0;
+        } else if (strncmp(optarg, "json", 4) == 0 &&
+                   (optarg[4] == 0 || optarg[4] == ':')) {
+          timing_json = 1;
+          timing_file = optarg[4]? optarg + 5: NULL;
+        } else {
+          avrdude_message(MSG_INFO, "%s: invalid timing report format \"%s\", "
+                          "expected text, json or json:<file>\n",
+                          progname, optarg);
+          exit(1);
+        }
+        timing_enabled = 1;
+        break;
+
       case 'u' : /* Disable safemode */
         safemode = 0;
         break;
@@ -764,7 +1060,11 @@ int main(int argc, char * argv [])
     i = strlen(usr_config);
     if (i && (usr_config[i - 1] != '/'))
       strcat(usr_config, "/");
+    strcpy(usr_cache, usr_config);
+    strcpy(usr_sck_cache, usr_config);
     strcat(usr_config, USER_CONF_FILE);
+    strcat(usr_cache, USER_CACHE_FILE);
+    strcat(usr_sck_cache, USER_SCK_CACHE_FILE);
   }
 #endif
 
@@ -792,7 +1092,8 @@ int main(int argc, char * argv [])
   avrdude_message(MSG_NOTICE, "%sSystem wide configuration file is \"%s\"\n",
             progbuf, sys_config);
 
-  rc = read_config(sys_config);
+  phase = timing_begin("config");
+  rc = read_config_cached(sys_config, usr_cache, rebuild_cache);
   if (rc) {
     avrdude_message(MSG_INFO, "%s: error reading system wide configuration file \"%s\"\n",
                     progname, sys_config);
@@ -837,6 +1138,8 @@ int main(int argc, char * argv [])
     }
   }
 
+  timing_end(phase);
+
   // set bitclock from configuration files unless changed by command line
   if (default_bitclock > 0 && bitclock == 0.0) {
     bitclock = default_bitclock;
@@ -984,6 +1287,22 @@ int main(int argc, char * argv [])
   if (isatty(STDIN_FILENO) == 0 && silentsafe == 0)
     safemode  = 0;       /* Turn off safemode if this isn't a terminal */
 
+  if (lsize(ports) > 1) {
+    if (terminal) {
+      avrdude_message(MSG_INFO, "%s: terminal mode cannot be used with multiple -P options\n",
+                      progname);
+      exit(1);
+    }
+    if (capture) {
+      avrdude_message(MSG_INFO, "%s: -S cannot be used with multiple -P options\n",
+                      progname);
+      exit(1);
+    }
+    /* concurrent sessions cannot ask questions on the same terminal */
+    if (silentsafe == 0)
+      safemode = 0;
+  }
+
 
   if(p->flags & AVRPART_AVR32) {
     safemode = 0;
@@ -1034,6 +1353,18 @@ int main(int argc, char * argv [])
     exit(1);
   }
 
+  if (lsize(ports) > 1) {
+#if defined(WIN32)
+    avrdude_message(MSG_INFO, "%s: multiple -P options are not supported on this platform\n",
+                    progname);
+    exit(1);
+#else
+    port = fork_targets(ports, &exitrc);
+    if (port == NULL)
+      goto main_exit;
+#endif
+  }
+
   if (verbose) {
     avrdude_message(MSG_NOTICE, "%sUsing Port                    : %s\n", progbuf, port);
     avrdude_message(MSG_NOTICE, "%sUsing Programmer              : %s\n", progbuf, programmer);
@@ -1059,6 +1390,10 @@ int main(int argc, char * argv [])
     pgm->ispdelay = ispdelay;
   }
 
+  if (capture != NULL && serial_capture_start(capture) < 0)
+    exit(1);
+
+  phase = timing_begin("open");
   rc = pgm->open(pgm, port);
   if (rc < 0) {
     exitrc = 1;
@@ -1066,6 +1401,7 @@ int main(int argc, char * argv [])
     goto main_exit;
   }
   is_open = 1;
+  timing_end(phase);
 
   if (calibrate) {
     /*
@@ -1102,6 +1438,7 @@ int main(int argc, char * argv [])
   /*
    * enable the programmer
    */
+  phase = timing_begin("initialize");
   pgm->enable(pgm);
 
   /*
@@ -1128,6 +1465,14 @@ int main(int argc, char * argv [])
     }
   }
 
+  timing_end(phase);
+
+  if (init_ok && bitclock_auto) {
+    phase = timing_begin("sck tuning");
+    auto_bitclock(pgm, p, usr_sck_cache);
+    timing_end(phase);
+  }
+
   /* indicate ready */
   pgm->rdy_led(pgm, ON);
 
@@ -1142,6 +1487,7 @@ int main(int argc, char * argv [])
    * against 0xffffff / 0x000000 should ensure that the signature bytes
    * are valid.
    */
+  phase = timing_begin("signature");
   if(!(p->flags & AVRPART_AVR32)) {
     int attempt = 0;
     int waittime = 10000;       /* 10 ms */
@@ -1270,10 +1616,13 @@ int main(int argc, char * argv [])
     }
   }
 
+  timing_end(phase);
+
   if (init_ok && safemode == 1) {
     /* If safemode is enabled, go ahead and read the current low, high,
        and extended fuse bytes as needed */
 
+    phase = timing_begin("safemode");
     rc = safemode_readfuses(&safemode_lfuse, &safemode_hfuse,
                            &safemode_efuse, &safemode_fuse, pgm, p);
 
@@ -1298,9 +1647,42 @@ int main(int argc, char * argv [])
       //Save the fuses as default
       safemode_memfuses(1, &safemode_lfuse, &safemode_hfuse, &safemode_efuse, &safemode_fuse);
     }
+    timing_end(phase);
+  }
+
+  if ((uflags & UF_AUTO_ERASE) && !(uflags & UF_INCREMENTAL) && init_ok &&
+      (p->flags & (AVRPART_HAS_PDI | AVRPART_HAS_UPDI)) &&
+      pgm->page_erase != NULL && lsize(updates) > 0) {
+    /*
+     * The part can be erased either way, let the planner pick the
+     * cheaper one for the data at hand.
+     */
+    phase = timing_begin("erase planning");
+    erase_plan = plan_erase(pgm, p, updates);
+    timing_end(phase);
+    switch (erase_plan) {
+    case ERASE_PLAN_PAGE:
+      if (quell_progress < 2) {
+        avrdude_message(MSG_INFO, "%s: NOTE: erase planner: each page will be erased before programming it,\n"
+                        "%sbut no chip erase is performed.\n"
+                        "%sTo disable page erases, specify the -D option; for a chip-erase, use the -e option.\n",
+                        progname, progbuf, progbuf);
+      }
+      break;
+    case ERASE_PLAN_CHIP:
+      if (quell_progress < 2) {
+        avrdude_message(MSG_INFO, "%s: NOTE: erase planner: a chip erase is cheaper than erasing each page,\n"
+                        "%san erase cycle will be performed.\n"
+                        "%sTo disable this feature, specify the -D option.\n",
+                        progname, progbuf, progbuf);
+      }
+      uflags &= ~UF_AUTO_ERASE;
+      erase = 1;
+      break;
+    }
   }
 
-  if (uflags & UF_AUTO_ERASE) {
+  if ((uflags & UF_AUTO_ERASE) && erase_plan < 0) {
     if ((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL &&
         lsize(updates) > 0) {
       if (quell_progress < 2) {
@@ -1309,6 +1691,20 @@ int main(int argc, char * argv [])
                         "%sTo disable page erases, specify the -D option; for a chip-erase, use the -e option.\n",
                         progname, progbuf, progbuf);
       }
+    } else if ((uflags & UF_INCREMENTAL) &&
+               (p->flags & (AVRPART_HAS_PDI | AVRPART_HAS_UPDI)) &&
+               pgm->page_erase != NULL && pgm->paged_load != NULL &&
+               lsize(updates) > 0) {
+      /*
+       * Only PDI and UPDI parts have a flash page erase every
+       * programmer implements; on classic parts it typically fails
+       * for flash, so those still get a chip erase below.
+       */
+      if (quell_progress < 2) {
+        avrdude_message(MSG_INFO, "%s: NOTE: Incremental mode, each changed page will be erased before programming it,\n"
+                        "%sbut no chip erase is performed.\n",
+                        progname, progbuf);
+      }
     } else {
       AVRMEM * m;
       const char *memname = (p->flags & AVRPART_HAS_PDI)? "application": "flash";
@@ -1333,6 +1729,17 @@ int main(int argc, char * argv [])
     }
   }
 
+  if (erase && (uflags & UF_INCREMENTAL)) {
+    /*
+     * after a chip erase there is nothing left to compare against
+     */
+    if (quell_progress < 2) {
+      avrdude_message(MSG_INFO, "%s: NOTE: the chip will be erased, incremental mode disabled\n",
+                      progname);
+    }
+    uflags &= ~UF_INCREMENTAL;
+  }
+
   if (init_ok && erase) {
     /*
      * erase the chip's flash and eeprom memories, this is required
@@ -1345,8 +1752,12 @@ int main(int argc, char * argv [])
       if (quell_progress < 2) {
       	avrdude_message(MSG_INFO, "%s: erasing chip\n", progname);
       }
+      phase = timing_begin("chip erase");
       exitrc = avr_chip_erase(pgm, p);
       if(exitrc) goto main_exit;
+      timing_end(phase);
+      if (pgm->erase_blanks)
+        uflags |= UF_ERASED;
     }
   }
 
@@ -1368,7 +1779,11 @@ int main(int argc, char * argv [])
 
   for (ln=lfirst(updates); ln; ln=lnext(ln)) {
     upd = ldata(ln);
+    phase = timing_begin("%s:%c", upd->memtype,
+                         upd->op == DEVICE_READ? 'r':
+                         upd->op == DEVICE_WRITE? 'w': 'v');
     rc = do_op(pgm, p, upd, uflags);
+    timing_end(phase);
     if (rc) {
       exitrc = 1;
       break;
@@ -1395,6 +1810,7 @@ int main(int argc, char * argv [])
     safemode_memfuses(0, &safemode_lfuse, &safemode_hfuse, &safemode_efuse, &safemode_fuse);
 
     /* Try reading back fuses, make sure they are reliable to read back */
+    phase = timing_begin("safemode check");
     if (safemode_readfuses(&safemodeafter_lfuse, &safemodeafter_hfuse,
                            &safemodeafter_efuse, &safemodeafter_fuse, pgm, p) != 0) {
       /* Uh-oh.. try once more to read back fuses */
@@ -1408,6 +1824,8 @@ int main(int argc, char * argv [])
       }
     }
     
+    timing_end(phase);
+
     AVRMEM * m;
     
     /* Now check what fuses are against what they should be */
@@ -1544,7 +1962,10 @@ main_exit:
    * program complete
    */
 
+  avr_ready_report();
+
   if (is_open) {
+    phase = timing_begin("close");
     pgm->powerdown(pgm);
 
     pgm->disable(pgm);
@@ -1552,6 +1973,23 @@ main_exit:
     pgm->rdy_led(pgm, OFF);
 
     pgm->close(pgm);
+    timing_end(phase);
+  }
+
+  serial_capture_end();
+
+  if (timing_enabled && port != NULL) {
+    FILE * f = stdout;
+
+    if (timing_json && timing_file != NULL &&
+        (f = fopen(timing_file, "a")) == NULL) {
+      avrdude_message(MSG_INFO, "%s: cannot open timing report file \"%s\": %s\n",
+                      progname, timing_file, strerror(errno));
+    } else {
+      timing_report(f, timing_json, programmer, p? p->id: NULL, port);
+      if (f != stdout)
+        fclose(f);
+    }
   }
 
   if (quell_progress < 2) {
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <io.h>
 #include <malloc.h> 
+#include <process.h>
 
 #pragma comment(lib, "advapi32.lib")
 #pragma comment(lib, "hid.lib")
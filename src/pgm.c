@@ -21,6 +21,7 @@
 
 #include "ac_cfg.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -83,6 +84,10 @@ PROGRAMMER * pgm_new(void)
   pgm->lineno = 0;
   pgm->baudrate = 0;
   pgm->initpgm = NULL;
+  pgm->erase_blanks = 1;
+  pgm->chip_erase_trips = 1;
+  pgm->page_erase_trips = 1;
+  pgm->page_write_trips = 1;
 
   for (i=0; i<N_PINS; i++) {
     pgm->pinno[i] = 0;
@@ -127,6 +132,7 @@ PROGRAMMER * pgm_new(void)
   pgm->paged_load     = NULL;
   pgm->write_setup    = NULL;
   pgm->read_sig_bytes = NULL;
+  pgm->verify_crc     = NULL;
   pgm->set_vtarget    = NULL;
   pgm->set_varef      = NULL;
   pgm->set_fosc       = NULL;
@@ -259,27 +265,112 @@ void pgm_display_generic(PROGRAMMER * pgm, const char * p)
   pgm_display_generic_mask(pgm, p, SHOW_ALL_PINS);
 }
 
+/*
+ * Index of all programmer ids (in lower case) of the programmer list
+ * searched last.  Programmers added at either end of that list are
+ * added to it as they show up; any other change of the list rebuilds
+ * it.  Each id maps to the first programmer in list order carrying it.
+ */
+static LISTID pgm_index_list;
+static unsigned long pgm_index_gen;
+static LNODEID pgm_index_first, pgm_index_last;
+static HASHID pgm_index;
+
+static int pgm_lower_key(char * buf, size_t size, const char * s)
+{
+  size_t i;
+
+  for (i = 0; s[i]; i++) {
+    if (i + 1 >= size)
+      return -1;
+    buf[i] = tolower((unsigned char)s[i]);
+  }
+  buf[i] = 0;
+
+  return i;
+}
+
+/*
+ * Enter all ids of p.  A programmer that comes earlier in the list
+ * than the one already there replaces it (override), a later one
+ * does not.
+ */
+static void pgm_index_add(PROGRAMMER * p, int override)
+{
+  LNODEID ln;
+  char key[PGM_DESCLEN];
+  void ** slot;
+  int l;
+
+  for (ln=lfirst(p->id); ln; ln=lnext(ln)) {
+    l = pgm_lower_key(key, sizeof(key), ldata(ln));
+    if (l < 0)
+      continue;
+    slot = hslot(pgm_index, key, l);
+    if (slot == NULL) {
+      avrdude_message(MSG_INFO, "%s: out of memory indexing programmers\n",
+                      progname);
+      exit(1);
+    }
+    if (*slot == NULL || override)
+      *slot = p;
+  }
+}
+
+static HASHID pgm_update_index(LISTID programmers)
+{
+  LNODEID ln1;
+
+  if (pgm_index == NULL || pgm_index_list != programmers ||
+      pgm_index_gen != lgen(programmers)) {
+    hdestroy(pgm_index);
+    pgm_index = hcreat();
+    if (pgm_index == NULL) {
+      avrdude_message(MSG_INFO, "%s: out of memory indexing programmers\n",
+                      progname);
+      exit(1);
+    }
+    pgm_index_list = programmers;
+    pgm_index_gen = lgen(programmers);
+    pgm_index_first = pgm_index_last = NULL;
+  }
+
+  if (pgm_index_first == NULL) {
+    for (ln1=lfirst(programmers); ln1; ln1=lnext(ln1))
+      pgm_index_add(ldata(ln1), 0);
+  } else {
+    /* programmers pushed in front of the indexed ones take precedence */
+    for (ln1=lprev(pgm_index_first); ln1; ln1=lprev(ln1))
+      pgm_index_add(ldata(ln1), 1);
+    for (ln1=lnext(pgm_index_last); ln1; ln1=lnext(ln1))
+      pgm_index_add(ldata(ln1), 0);
+  }
+  pgm_index_first = lfirst(programmers);
+  pgm_index_last = llast(programmers);
+
+  return pgm_index;
+}
+
 PROGRAMMER * locate_programmer(LISTID programmers, const char * configid)
 {
   LNODEID ln1, ln2;
-  PROGRAMMER * p = NULL;
-  const char * id;
-  int found;
+  PROGRAMMER * p;
+  char key[PGM_DESCLEN];
+  int l;
 
-  found = 0;
+  l = pgm_lower_key(key, sizeof(key), configid);
+  if (l >= 0)
+    return hget(pgm_update_index(programmers), key, l);
 
-  for (ln1=lfirst(programmers); ln1 && !found; ln1=lnext(ln1)) {
+  /* ids this long are not indexed, fall back to searching the list */
+  for (ln1=lfirst(programmers); ln1; ln1=lnext(ln1)) {
     p = ldata(ln1);
-    for (ln2=lfirst(p->id); ln2 && !found; ln2=lnext(ln2)) {
-      id = ldata(ln2);
-      if (strcasecmp(configid, id) == 0)
-        found = 1;
+    for (ln2=lfirst(p->id); ln2; ln2=lnext(ln2)) {
+      if (strcasecmp(configid, ldata(ln2)) == 0)
+        return p;
     }
   }
 
-  if (found)
-    return p;
-
   return NULL;
 }
 
@@ -47,6 +47,7 @@
 #include "ppi.h"
 #include "serbb.h"
 #include "serialupdi.h"
+#include "sim.h"
 #include "stk500.h"
 #include "stk500generic.h"
 #include "stk500v2.h"
@@ -92,6 +93,7 @@ const PROGRAMMER_TYPE programmers_types[] = {
         {"pickit2", pickit2_initpgm, pickit2_desc},
         {"serbb", serbb_initpgm, serbb_desc},
         {"serialupdi", serialupdi_initpgm, serialupdi_desc},
+        {"sim", sim_initpgm, sim_desc},
         {"stk500", stk500_initpgm, stk500_desc},
         {"stk500generic", stk500generic_initpgm, stk500generic_desc},
         {"stk500v2", stk500v2_initpgm, stk500v2_desc},
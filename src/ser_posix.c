@@ -71,17 +71,100 @@ static struct baud_mapping baud_lookup_table [] = {
 #endif
 #ifdef B230400
   { 230400, B230400 },
+#endif
+#ifdef B460800
+  { 460800, B460800 },
+#endif
+#ifdef B500000
+  { 500000, B500000 },
+#endif
+#ifdef B921600
+  { 921600, B921600 },
+#endif
+#ifdef B1000000
+  { 1000000, B1000000 },
 #endif
   { 0,      0 }                 /* Terminator. */
 };
 
+/*
+ * Linux can set arbitrary rates through the termios2 interface.  Its
+ * header cannot be combined with <termios.h>, so the structure is
+ * declared here.
+ */
+#if defined(__linux__) && defined(TCGETS2)
+#define HAVE_TERMIOS2 1
+
+struct ser_termios2 {
+  tcflag_t c_iflag;
+  tcflag_t c_oflag;
+  tcflag_t c_cflag;
+  tcflag_t c_lflag;
+  cc_t c_line;
+  cc_t c_cc[19];
+  speed_t c_ispeed;
+  speed_t c_ospeed;
+};
+
+#define SER_TCGETS2 _IOR('T', 0x2A, struct ser_termios2)
+#define SER_TCSETS2 _IOW('T', 0x2B, struct ser_termios2)
+
+#if defined(__sparc__)
+#  define SER_BOTHER 0x00001000
+#else
+#  define SER_BOTHER 0010000
+#endif
+#endif /* __linux__ && TCGETS2 */
+
 static struct termios original_termios;
 static int saved_original_termios;
 
-static speed_t serial_baud_lookup(long baud)
+/*
+ * Read-ahead buffer per file descriptor.  Whatever the device has
+ * available is read at once, and small ser_recv() requests (most
+ * protocol parsers fetch a byte at a time) are served from here.
+ */
+#define SER_RABUF_SIZE 4096
+
+struct ser_rabuf {
+  size_t pos, len;
+  unsigned char buf[SER_RABUF_SIZE];
+};
+
+static struct ser_rabuf * ser_rabuf[FD_SETSIZE];
+
+/* system call counts, reported on close */
+static unsigned long ser_nselect, ser_nread, ser_nwrite, ser_nrecv;
+
+static struct ser_rabuf * ser_getrabuf(int fd)
+{
+  if (fd < 0 || fd >= FD_SETSIZE)
+    return NULL;
+  if (ser_rabuf[fd] == NULL) {
+    ser_rabuf[fd] = malloc(sizeof(struct ser_rabuf));
+    if (ser_rabuf[fd] == NULL) {
+      avrdude_message(MSG_INFO, "%s: out of memory allocating serial buffer\n",
+                      progname);
+      exit(1);
+    }
+    ser_rabuf[fd]->pos = ser_rabuf[fd]->len = 0;
+  }
+  return ser_rabuf[fd];
+}
+
+static void ser_freerabuf(int fd)
+{
+  if (fd < 0 || fd >= FD_SETSIZE)
+    return;
+  free(ser_rabuf[fd]);
+  ser_rabuf[fd] = NULL;
+}
+
+static speed_t serial_baud_lookup(long baud, int * nonstandard)
 {
   struct baud_mapping *map = baud_lookup_table;
 
+  *nonstandard = 0;
   while (map->baud) {
     if (map->baud == baud)
       return map->speed;
@@ -92,12 +175,55 @@ static speed_t serial_baud_lookup(long baud)
    * If a non-standard BAUD rate is used, issue
    * a warning (if we are verbose) and return the raw rate
    */
-  avrdude_message(MSG_NOTICE, "%s: serial_baud_lookup(): Using non-standard baud rate: %ld",
+  avrdude_message(MSG_NOTICE, "%s: serial_baud_lookup(): Using non-standard baud rate: %ld\n",
               progname, baud);
 
+  *nonstandard = 1;
+#ifdef HAVE_TERMIOS2
+  /* placeholder, the actual rate is set by ser_setbaud_termios2() */
+  return B38400;
+#else
   return baud;
+#endif
 }
 
+#ifdef HAVE_TERMIOS2
+/*
+ * Set an arbitrary baud rate, and report the rate the driver actually
+ * uses if that differs.
+ */
+static int ser_setbaud_termios2(int fd, long baud)
+{
+  struct ser_termios2 tio;
+
+  if (ioctl(fd, SER_TCGETS2, &tio) < 0) {
+    avrdude_message(MSG_INFO, "%s: ser_setparams(): TCGETS2 failed\n",
+            progname);
+    return -errno;
+  }
+
+  tio.c_cflag &= ~CBAUD;
+  tio.c_cflag |= SER_BOTHER;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+
+  if (ioctl(fd, SER_TCSETS2, &tio) < 0) {
+    avrdude_message(MSG_INFO, "%s: ser_setparams(): can't set baud rate %ld\n",
+            progname, baud);
+    return -errno;
+  }
+
+  if (ioctl(fd, SER_TCGETS2, &tio) == 0 && tio.c_ospeed != (speed_t)baud) {
+    avrdude_message(MSG_INFO, "%s: ser_setparams(): requested baud rate %ld, "
+            "actual rate %lu (%+.1f%%)\n",
+            progname, baud, (unsigned long)tio.c_ospeed,
+            100.0 * ((double)tio.c_ospeed - baud) / baud);
+  }
+
+  return 0;
+}
+#endif
+
 static tcflag_t translate_flags(unsigned long cflags)
 {
   return ((cflags & SERIAL_CS5)                      ? CS5    : 0) |
@@ -115,7 +241,8 @@ static int ser_setparams(union filedescriptor *fd, long baud, unsigned long cfla
 {
   int rc;
   struct termios termios;
-  speed_t speed = serial_baud_lookup (baud);
+  int nonstandard;
+  speed_t speed = serial_baud_lookup (baud, &nonstandard);
   
   if (!isatty(fd->ifd))
     return -ENOTTY;
@@ -154,6 +281,14 @@ static int ser_setparams(union filedescriptor *fd, long baud, unsigned long cfla
     return -errno;
   }
 
+#ifdef HAVE_TERMIOS2
+  if (nonstandard) {
+    rc = ser_setbaud_termios2(fd->ifd, baud);
+    if (rc < 0)
+      return rc;
+  }
+#endif
+
   /*
    * Everything is now set up for a local line without modem control
    * or flow control, so clear O_NONBLOCK again.
@@ -330,6 +465,11 @@ static void ser_close(union filedescriptor *fd)
     saved_original_termios = 0;
   }
 
+  avrdude_message(MSG_TRACE, "%s: ser_close(): %lu recv requests took %lu select() "
+                  "and %lu read() calls; %lu write() calls\n",
+                  progname, ser_nrecv, ser_nselect, ser_nread, ser_nwrite);
+
+  ser_freerabuf(fd->ifd);
   close(fd->ifd);
 }
 
@@ -366,6 +506,7 @@ static int ser_send(union filedescriptor *fd, const unsigned char * buf, size_t
 
   while (len) {
     rc = write(fd->ifd, p, (len > 1024) ? 1024 : len);
+    ser_nwrite++;
     if (rc < 0) {
       avrdude_message(MSG_INFO, "%s: ser_send(): write error: %s\n",
               progname, strerror(errno));
@@ -386,18 +527,33 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
   int nfds;
   int rc;
   unsigned char * p = buf;
-  size_t len = 0;
+  size_t len = 0, n;
+  struct ser_rabuf * rb = ser_getrabuf(fd->ifd);
 
   timeout.tv_sec  = serial_recv_timeout / 1000L;
   timeout.tv_usec = (serial_recv_timeout % 1000L) * 1000;
   to2 = timeout;
 
+  ser_nrecv++;
+
   while (len < buflen) {
+    if (rb != NULL && rb->pos < rb->len) {
+      n = rb->len - rb->pos;
+      if (n > buflen - len)
+        n = buflen - len;
+      memcpy(p, rb->buf + rb->pos, n);
+      rb->pos += n;
+      p += n;
+      len += n;
+      continue;
+    }
+
   reselect:
     FD_ZERO(&rfds);
     FD_SET(fd->ifd, &rfds);
 
     nfds = select(fd->ifd + 1, &rfds, NULL, NULL, &to2);
+    ser_nselect++;
     if (nfds == 0) {
       avrdude_message(MSG_NOTICE2, "%s: ser_recv(): programmer is not responding\n",
                         progname);
@@ -416,14 +572,29 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
       }
     }
 
-    rc = read(fd->ifd, p, (buflen - len > 1024) ? 1024 : buflen - len);
-    if (rc < 0) {
-      avrdude_message(MSG_INFO, "%s: ser_recv(): read error: %s\n",
-              progname, strerror(errno));
-      return -1;
+    if (rb == NULL || buflen - len >= SER_RABUF_SIZE) {
+      /* large request, no point in going through the buffer */
+      rc = read(fd->ifd, p, buflen - len);
+      ser_nread++;
+      if (rc < 0) {
+        avrdude_message(MSG_INFO, "%s: ser_recv(): read error: %s\n",
+                progname, strerror(errno));
+        return -1;
+      }
+      p += rc;
+      len += rc;
+    } else {
+      /* read whatever is available, and serve the request from there */
+      rc = read(fd->ifd, rb->buf, SER_RABUF_SIZE);
+      ser_nread++;
+      if (rc < 0) {
+        avrdude_message(MSG_INFO, "%s: ser_recv(): read error: %s\n",
+                progname, strerror(errno));
+        return -1;
+      }
+      rb->pos = 0;
+      rb->len = rc;
     }
-    p += rc;
-    len += rc;
   }
 
   p = buf;
@@ -459,6 +630,7 @@ static int ser_drain(union filedescriptor *fd, int display)
   int nfds;
   int rc;
   unsigned char buf;
+  struct ser_rabuf * rb = ser_getrabuf(fd->ifd);
 
   timeout.tv_sec = 0;
   timeout.tv_usec = 250000;
@@ -467,12 +639,20 @@ static int ser_drain(union filedescriptor *fd, int display)
     avrdude_message(MSG_INFO, "drain>");
   }
 
+  /* whatever has been read ahead is drained first */
+  for (; rb != NULL && rb->pos < rb->len; rb->pos++) {
+    if (display) {
+      avrdude_message(MSG_INFO, "%02x ", rb->buf[rb->pos]);
+    }
+  }
+
   while (1) {
     FD_ZERO(&rfds);
     FD_SET(fd->ifd, &rfds);
 
   reselect:
     nfds = select(fd->ifd + 1, &rfds, NULL, NULL, &timeout);
+    ser_nselect++;
     if (nfds == 0) {
       if (display) {
         avrdude_message(MSG_INFO, "<drain\n");
@@ -492,6 +672,7 @@ static int ser_drain(union filedescriptor *fd, int display)
     }
 
     rc = read(fd->ifd, &buf, 1);
+    ser_nread++;
     if (rc < 0) {
       avrdude_message(MSG_INFO, "%s: ser_drain(): read error: %s\n",
               progname, strerror(errno));
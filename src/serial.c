@@ -0,0 +1,505 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2022 The AVRDUDE authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Transfers through the serial device currently selected in serdev.
+ * Every backend sends and receives through these, so this is where
+ * the traffic of a session is accounted for: calls, bytes, receive
+ * timeouts, retries, and a histogram of the time from a send to the
+ * first answer that comes back for it.
+ *
+ * This is also where a session can be recorded to a capture file, and
+ * where a captured session is played back in place of the programmer.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "avrdude.h"
+#include "libavrdude.h"
+
+struct serial_stats serial_stats;
+
+static double last_send;        /* time of the last unanswered send, or 0 */
+static int timed_out;           /* last receive failed, nothing since */
+
+/*
+ * One line of a capture file:
+ *
+ *   O <rep> <wep> <eep> <max_xfer> <intr> <port>    serial_open()
+ *   S <us> <rc> <hex data>                          serial_send()
+ *   R <us> <rc> <hex data>                          serial_recv()
+ *
+ * <us> is the time the call took, lines starting with # are comments.
+ */
+struct capture_rec {
+  char            type;
+  int             line;
+  long            us;
+  int             rc;
+  int             usb[5];
+  unsigned char * data;
+  size_t          len;
+};
+
+static FILE * capture_file;             /* recording to this file */
+static struct capture_rec * replay_recs; /* or playing these back */
+static int replay_nrecs, replay_next;
+static double replay_scale;             /* latency factor, 0 = none */
+static const char * replay_name;
+
+static int replay_open(char * port, union pinfo pinfo, union filedescriptor *fd);
+static int replay_setparams(union filedescriptor *fd, long baud, unsigned long cflags);
+static void replay_close(union filedescriptor *fd);
+static int replay_send(union filedescriptor *fd, const unsigned char * buf, size_t buflen);
+static int replay_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen);
+static int replay_drain(union filedescriptor *fd, int display);
+static int replay_set_dtr_rts(union filedescriptor *fd, int is_on);
+
+static struct serial_device replay_serdev = {
+  .open = replay_open,
+  .setparams = replay_setparams,
+  .close = replay_close,
+  .send = replay_send,
+  .recv = replay_recv,
+  .drain = replay_drain,
+  .set_dtr_rts = replay_set_dtr_rts,
+  .flags = SERDEV_FL_NONE,
+};
+
+
+/*
+ * Bucket i counts turnarounds of [2^i, 2^(i+1)) microseconds; the
+ * first and last buckets take everything below and above.
+ */
+static void serial_latency(double us)
+{
+  int i;
+
+  for (i = 0; i < SERIAL_LATENCY_BUCKETS - 1 && us >= (2UL << i); i++)
+    ;
+  serial_stats.latency[i]++;
+}
+
+
+static void capture_write(char type, double t0, int rc,
+                          const unsigned char * buf, size_t len)
+{
+  size_t i;
+
+  fprintf(capture_file, "%c %ld %d ", type, (long) ((timing_now() - t0) * 1e6), rc);
+  for (i = 0; i < len; i++)
+    fprintf(capture_file, "%02x", buf[i]);
+  fputc('\n', capture_file);
+}
+
+
+int serial_open(char * port, union pinfo pinfo, union filedescriptor *fd)
+{
+  int rc;
+
+  /*
+   * The backend has just picked the device for its port; when
+   * replaying, take its place but keep its capabilities.
+   */
+  if (replay_recs != NULL) {
+    replay_serdev.flags = serdev->flags;
+    serdev = &replay_serdev;
+  }
+
+  rc = serdev->open(port, pinfo, fd);
+  if (rc >= 0 && capture_file != NULL)
+    fprintf(capture_file, "O %d %d %d %d %d %s\n", fd->usb.rep, fd->usb.wep,
+            fd->usb.eep, fd->usb.max_xfer, fd->usb.use_interrupt_xfer, port);
+
+  return rc;
+}
+
+
+int serial_send(union filedescriptor *fd, const unsigned char * buf, size_t buflen)
+{
+  double t0 = capture_file? timing_now(): 0;
+  int rc;
+
+  /* sending again without having heard back is a retry */
+  if (timed_out) {
+    serial_stats.retries++;
+    timed_out = 0;
+  }
+
+  rc = serdev->send(fd, buf, buflen);
+  if (capture_file != NULL)
+    capture_write('S', t0, rc, buf, buflen);
+  serial_stats.sends++;
+  if (rc >= 0) {
+    serial_stats.bytes_sent += buflen;
+    if (last_send == 0)
+      last_send = timing_now();
+  }
+
+  return rc;
+}
+
+
+int serial_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen)
+{
+  double t0 = capture_file? timing_now(): 0;
+  int rc;
+
+  rc = serdev->recv(fd, buf, buflen);
+  if (capture_file != NULL) {
+    /* the tty device returns 0, the USB ones the number of bytes read */
+    capture_write('R', t0, rc, buf,
+                  rc < 0? 0: rc > 0 && (size_t) rc < buflen? (size_t) rc: buflen);
+  }
+  serial_stats.recvs++;
+  if (rc >= 0) {
+    serial_stats.bytes_received += buflen;
+    if (last_send != 0) {
+      serial_stats.round_trips++;
+      serial_latency((timing_now() - last_send) * 1e6);
+      last_send = 0;
+    }
+    timed_out = 0;
+  } else {
+    serial_stats.timeouts++;
+    timed_out = 1;
+  }
+
+  return rc;
+}
+
+
+void serial_stats_reset(void)
+{
+  memset(&serial_stats, 0, sizeof(serial_stats));
+  last_send = 0;
+  timed_out = 0;
+}
+
+
+/*
+ * Lower bound of latency bucket i in microseconds.
+ */
+unsigned long serial_latency_min(int i)
+{
+  return i == 0? 0: 1UL << i;
+}
+
+
+void serial_stats_report(void)
+{
+  unsigned long n, max;
+  int i, lo, hi, w;
+
+  avrdude_message(MSG_INFO, "%s: serial traffic: %lu sends (%lu bytes), "
+                  "%lu receives (%lu bytes)\n"
+                  "%s%lu receive timeouts, %lu retries\n",
+                  progname, serial_stats.sends, serial_stats.bytes_sent,
+                  serial_stats.recvs, serial_stats.bytes_received,
+                  progbuf, serial_stats.timeouts, serial_stats.retries);
+
+  for (n = max = 0, lo = -1, hi = 0, i = 0; i < SERIAL_LATENCY_BUCKETS; i++) {
+    n += serial_stats.latency[i];
+    if (serial_stats.latency[i] > max)
+      max = serial_stats.latency[i];
+    if (serial_stats.latency[i]) {
+      if (lo < 0)
+        lo = i;
+      hi = i;
+    }
+  }
+  if (n == 0)
+    return;
+
+  avrdude_message(MSG_INFO, "%ssend to receive turnaround, %lu samples:\n",
+                  progbuf, n);
+  for (i = lo; i <= hi; i++) {
+    w = (int) ((serial_stats.latency[i] * 40 + max - 1) / max);
+    avrdude_message(MSG_INFO, "%s  %8lu us %8lu |%.*s\n", progbuf,
+                    serial_latency_min(i), serial_stats.latency[i], w,
+                    "########################################");
+  }
+}
+
+
+/*
+ * Parse a line of a capture file into r.  Returns -1 on syntax errors.
+ */
+static int capture_parse(char * line, struct capture_rec * r)
+{
+  char * hex;
+  size_t i;
+  unsigned int b;
+
+  memset(r, 0, sizeof(*r));
+  r->type = line[0];
+  switch (r->type) {
+  case 'O':
+    return sscanf(line + 1, "%d %d %d %d %d", &r->usb[0], &r->usb[1],
+                  &r->usb[2], &r->usb[3], &r->usb[4]) == 5? 0: -1;
+
+  case 'S':
+  case 'R':
+    if (sscanf(line + 1, "%ld %d", &r->us, &r->rc) != 2)
+      return -1;
+    /* skip the two numbers, the rest is data */
+    hex = line + 1;
+    for (i = 0; i < 2; i++) {
+      hex += strspn(hex, " ");
+      hex += strcspn(hex, " \n");
+    }
+    hex += strspn(hex, " ");
+    r->len = strcspn(hex, " \r\n") / 2;
+    if (r->len == 0)
+      return 0;
+    if ((r->data = malloc(r->len)) == NULL)
+      return -1;
+    for (i = 0; i < r->len; i++) {
+      if (sscanf(hex + 2 * i, "%2x", &b) != 1)
+        return -1;
+      r->data[i] = b;
+    }
+    return 0;
+  }
+
+  return -1;
+}
+
+
+/*
+ * Load a capture file for playback.
+ */
+static int replay_load(const char * name)
+{
+  static char line[65536];
+  struct capture_rec * recs;
+  FILE * f;
+  int n, lineno;
+
+  if ((f = fopen(name, "r")) == NULL) {
+    avrdude_message(MSG_INFO, "%s: cannot open capture file \"%s\": %s\n",
+                    progname, name, strerror(errno));
+    return -1;
+  }
+
+  for (lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    n = replay_nrecs + 1;
+    if ((recs = realloc(replay_recs, n * sizeof(*recs))) == NULL) {
+      avrdude_message(MSG_INFO, "%s: out of memory\n", progname);
+      fclose(f);
+      return -1;
+    }
+    replay_recs = recs;
+    if (capture_parse(line, &recs[replay_nrecs]) < 0) {
+      avrdude_message(MSG_INFO, "%s: %s:%d: invalid capture record\n",
+                      progname, name, lineno);
+      fclose(f);
+      return -1;
+    }
+    recs[replay_nrecs].line = lineno;
+    replay_nrecs = n;
+  }
+  fclose(f);
+
+  if (replay_nrecs == 0) {
+    avrdude_message(MSG_INFO, "%s: capture file \"%s\" is empty\n",
+                    progname, name);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Start recording to or playing back from a capture file, as given by
+ * "record:<file>" or "replay:<file>[:<scale>]".  The optional scale
+ * multiplies the recorded duration of each call, the default of 0
+ * replays as fast as possible.
+ */
+int serial_capture_start(const char * spec)
+{
+  static char name[PATH_MAX];
+  char * colon, * e;
+  double scale;
+
+  if (strncmp(spec, "record:", 7) == 0 && spec[7] != 0) {
+    capture_file = fopen(spec + 7, "w");
+    if (capture_file == NULL) {
+      avrdude_message(MSG_INFO, "%s: cannot create capture file \"%s\": %s\n",
+                      progname, spec + 7, strerror(errno));
+      return -1;
+    }
+    fprintf(capture_file, "# avrdude serial capture\n");
+    return 0;
+  }
+
+  if (strncmp(spec, "replay:", 7) == 0 && spec[7] != 0) {
+    snprintf(name, sizeof(name), "%s", spec + 7);
+    scale = 0;
+    if ((colon = strrchr(name, ':')) != NULL && colon[1] != 0) {
+      scale = strtod(colon + 1, &e);
+      if (*e == 0 && scale >= 0)
+        *colon = 0;
+      else
+        scale = 0;
+    }
+    replay_scale = scale;
+    replay_name = name;
+    return replay_load(name);
+  }
+
+  avrdude_message(MSG_INFO, "%s: invalid capture specification \"%s\", expected "
+                  "record:<file> or replay:<file>[:<scale>]\n", progname, spec);
+  return -1;
+}
+
+
+void serial_capture_end(void)
+{
+  int i;
+
+  if (capture_file != NULL) {
+    fclose(capture_file);
+    capture_file = NULL;
+  }
+
+  if (replay_recs != NULL) {
+    if (replay_next < replay_nrecs)
+      avrdude_message(MSG_NOTICE, "%s: replay: %d records of \"%s\" not used\n",
+                      progname, replay_nrecs - replay_next, replay_name);
+    for (i = 0; i < replay_nrecs; i++)
+      free(replay_recs[i].data);
+    free(replay_recs);
+    replay_recs = NULL;
+    replay_nrecs = replay_next = 0;
+  }
+}
+
+
+/*
+ * Take the next record, which must be of the given type, and wait for
+ * as long as the original call took.
+ */
+static struct capture_rec * replay_take(char type)
+{
+  struct capture_rec * r;
+
+  if (replay_next >= replay_nrecs) {
+    avrdude_message(MSG_INFO, "%s: replay: end of \"%s\" reached\n",
+                    progname, replay_name);
+    return NULL;
+  }
+
+  r = &replay_recs[replay_next];
+  if (r->type != type) {
+    avrdude_message(MSG_INFO, "%s: replay: %s:%d: session diverges, "
+                    "expected '%c' record, found '%c'\n",
+                    progname, replay_name, r->line, type, r->type);
+    return NULL;
+  }
+  replay_next++;
+
+  if (replay_scale > 0 && r->us > 0)
+    usleep((unsigned int) (r->us * replay_scale));
+
+  return r;
+}
+
+
+static int replay_open(char * port, union pinfo pinfo, union filedescriptor *fd)
+{
+  struct capture_rec * r;
+
+  if ((r = replay_take('O')) == NULL)
+    return -1;
+
+  memset(fd, 0, sizeof(*fd));
+  fd->usb.rep = r->usb[0];
+  fd->usb.wep = r->usb[1];
+  fd->usb.eep = r->usb[2];
+  fd->usb.max_xfer = r->usb[3];
+  fd->usb.use_interrupt_xfer = r->usb[4];
+
+  return 0;
+}
+
+
+static int replay_setparams(union filedescriptor *fd, long baud, unsigned long cflags)
+{
+  return 0;
+}
+
+
+static void replay_close(union filedescriptor *fd)
+{
+}
+
+
+static int replay_send(union filedescriptor *fd, const unsigned char * buf, size_t buflen)
+{
+  struct capture_rec * r;
+
+  if ((r = replay_take('S')) == NULL)
+    return -1;
+
+  if (r->len != buflen || memcmp(r->data, buf, buflen) != 0) {
+    avrdude_message(MSG_INFO, "%s: replay: %s:%d: session diverges, "
+                    "sending different data\n",
+                    progname, replay_name, r->line);
+    return -1;
+  }
+
+  return r->rc;
+}
+
+
+static int replay_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen)
+{
+  struct capture_rec * r;
+
+  if ((r = replay_take('R')) == NULL)
+    return -1;
+
+  memset(buf, 0, buflen);
+  memcpy(buf, r->data, r->len < buflen? r->len: buflen);
+
+  return r->rc;
+}
+
+
+static int replay_drain(union filedescriptor *fd, int display)
+{
+  return 0;
+}
+
+
+static int replay_set_dtr_rts(union filedescriptor *fd, int is_on)
+{
+  return 0;
+}
@@ -56,6 +56,9 @@ static void serialupdi_setup(PROGRAMMER * pgm)
   }
   memset(pgm->cookie, 0, sizeof(updi_state));
   updi_set_datalink_mode(pgm, UPDI_LINK_MODE_16BIT);
+  updi_set_erase_pending(pgm, -1);
+  /* state of the NVM controller unknown until first polled */
+  updi_set_nvm_busy(pgm, 1);
 }
 
 static void serialupdi_teardown(PROGRAMMER * pgm)
@@ -63,6 +66,37 @@ static void serialupdi_teardown(PROGRAMMER * pgm)
   free(pgm->cookie);
 }
 
+static int serialupdi_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+  LNODEID ln;
+  const char *extended_param;
+  int rv = 0;
+
+  for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+    extended_param = ldata(ln);
+
+    if (strncmp(extended_param, "baudmax=", strlen("baudmax=")) == 0) {
+      long baud;
+      if (sscanf(extended_param, "baudmax=%li", &baud) != 1 || baud <= 0) {
+        avrdude_message(MSG_INFO, "%s: serialupdi_parseextparms(): invalid baud rate '%s'\n",
+                        progname, extended_param);
+        rv = -1;
+        continue;
+      }
+      avrdude_message(MSG_NOTICE2, "%s: serialupdi_parseextparms(): maximum baud rate set to %ld\n",
+                      progname, baud);
+      updi_set_baud_max(pgm, baud);
+      continue;
+    }
+
+    avrdude_message(MSG_INFO, "%s: serialupdi_parseextparms(): invalid extended parameter '%s'\n",
+                    progname, extended_param);
+    rv = -1;
+  }
+
+  return rv;
+}
+
 static int serialupdi_open(PROGRAMMER * pgm, char * port)
 {
   strcpy(pgm->port, port);
@@ -90,6 +124,8 @@ static int serialupdi_reset(PROGRAMMER * pgm, reset_mode mode)
             self.logger.info("Release reset")
             self.readwrite.write_cs(constants.UPDI_ASI_RESET_REQ, 0x00)
 */
+  /* a key may have started an erase, poll before the next NVM access */
+  updi_set_nvm_busy(pgm, 1);
   switch (mode) {
     case APPLY_RESET:
       avrdude_message(MSG_DEBUG, "%s: Sending reset request\n", progname);
@@ -179,6 +215,15 @@ static int serialupdi_decode_sib(PROGRAMMER * pgm, updi_sib_info * sib_info)
 
 static void serialupdi_close(PROGRAMMER * pgm)
 {
+  updi_nvm_counters * counters = updi_get_nvm_counters(pgm);
+
+  if (counters->pages > 0) {
+    avrdude_message(MSG_NOTICE, "%s: NVM ready polls: %lu for %lu pages (%.1f per page), "
+                    "%lu waits skipped\n",
+                    progname, counters->polls, counters->pages,
+                    (double)counters->polls / counters->pages, counters->skipped);
+  }
+
   avrdude_message(MSG_INFO, "%s: Leaving NVM programming mode\n", progname);
 
   if (serialupdi_leave_progmode(pgm) < 0) {
@@ -644,6 +689,12 @@ static int serialupdi_initialize(PROGRAMMER * pgm, AVRPART * p)
     return -1;
   }
 
+  if (updi_get_baud_max(pgm) > 0 &&
+      updi_link_escalate_baud(pgm, updi_get_baud_max(pgm)) < 0) {
+    avrdude_message(MSG_INFO, "%s: UPDI link lost while raising the baud rate\n", progname);
+    return -1;
+  }
+
   avrdude_message(MSG_INFO, "%s: Entering NVM programming mode\n", progname);
     /* try, but ignore failure */
   serialupdi_enter_progmode(pgm);
@@ -685,15 +736,34 @@ static int serialupdi_program_enable(PROGRAMMER * pgm, AVRPART * p)
   return -1;
 }
 
+/*
+ * A flash page erase is held back until the page is written, so both
+ * can be done with one erase-write command.  Anything else that comes
+ * in between carries out the erase first.
+ */
+static int serialupdi_flush_erase(PROGRAMMER * pgm, AVRPART * p)
+{
+  long address = updi_get_erase_pending(pgm);
+
+  if (address < 0)
+    return 0;
+  updi_set_erase_pending(pgm, -1);
+  return updi_nvm_erase_flash_page(pgm, p, address);
+}
+
 static int serialupdi_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, 
                                 unsigned long addr, unsigned char * value)
 {
+  if (serialupdi_flush_erase(pgm, p) < 0)
+    return -1;
   return updi_read_byte(pgm, mem->offset + addr, value);
 }
 
 static int serialupdi_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                                  unsigned long addr, unsigned char value)
 {
+  if (serialupdi_flush_erase(pgm, p) < 0)
+    return -1;
   if (strstr(mem->desc, "fuse") != 0) {
     return updi_nvm_write_fuse(pgm, p, mem->offset + addr, value);
   }
@@ -718,6 +788,8 @@ static int serialupdi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                  unsigned int page_size,
                                  unsigned int addr, unsigned int n_bytes)
 {
+  if (serialupdi_flush_erase(pgm, p) < 0)
+    return -1;
   if (n_bytes > m->readsize) {
     unsigned int read_offset = addr;
     unsigned int remaining_bytes = n_bytes;
@@ -746,6 +818,13 @@ static int serialupdi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                   unsigned int addr, unsigned int n_bytes)
 {
   int rc;
+  if (n_bytes <= m->page_size && strcmp(m->desc, "flash") == 0 &&
+      updi_get_erase_pending(pgm) == m->offset + addr) {
+    updi_set_erase_pending(pgm, -1);
+    return updi_nvm_erase_write_flash(pgm, p, m->offset+addr, m->buf+addr, n_bytes);
+  }
+  if (serialupdi_flush_erase(pgm, p) < 0)
+    return -1;
   if (n_bytes > m->page_size) {
     unsigned int write_offset = addr;
     unsigned int remaining_bytes = n_bytes;
@@ -870,6 +949,9 @@ static int serialupdi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
   uint8_t value;
 
+  /* the whole chip goes anyway */
+  updi_set_erase_pending(pgm, -1);
+
   if (updi_read_cs(pgm, UPDI_ASI_SYS_STATUS, &value)<0) {
     avrdude_message(MSG_INFO, "%s: Read CS operation during chip erase failed\n", progname);
     return -1;
@@ -890,8 +972,90 @@ static int serialupdi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 static int serialupdi_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                  unsigned int baseaddr)
 {
-  avrdude_message(MSG_INFO, "%s: error: page erase not implemented yet\n",
-    	    progname);
+  if (serialupdi_flush_erase(pgm, p) < 0)
+    return -1;
+  if (strcmp(m->desc, "flash") == 0) {
+    updi_set_erase_pending(pgm, m->offset + baseaddr);
+    return 0;
+  } else if (strcmp(m->desc, "eeprom") == 0) {
+    /* EEPROM pages are always written with erase-write */
+    return 0;
+  } else if (strcmp(m->desc, "userrow") == 0) {
+    return updi_nvm_erase_user_row(pgm, p, m->offset + baseaddr, m->page_size);
+  }
+  avrdude_message(MSG_INFO, "%s: page erase not supported for memory \"%s\"\n",
+                  progname, m->desc);
+  return -1;
+}
+
+/*
+ * The CRCSCAN peripheral cannot report a CRC, it only checks the flash
+ * against the CRC-16-CCITT stored big-endian in its last two bytes.
+ * So this only helps if the image carries a valid checksum there.
+ */
+static unsigned int serialupdi_crc16(const unsigned char * buf, unsigned int len)
+{
+  unsigned int crc = 0xffff;
+  unsigned int i;
+  int j;
+
+  for (i = 0; i < len; i++) {
+    crc ^= buf[i] << 8;
+    for (j = 0; j < 8; j++)
+      crc = (crc << 1) ^ (crc & 0x8000? 0x1021: 0);
+  }
+  return crc & 0xffff;
+}
+
+static int serialupdi_verify_crc(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+  unsigned long start_time;
+  unsigned long current_time;
+  struct timeval tv;
+  uint8_t value;
+  uint8_t stored[2];
+
+  if (strcmp(m->desc, "flash") != 0 || serialupdi_crc16(m->buf, m->size) != 0) {
+    return -1;
+  }
+
+  /*
+   * STATUS.OK only says the device flash matches the CRC stored in it,
+   * which any earlier image with a valid CRC does as well.  So the
+   * stored CRC must be the one of our image first.
+   */
+  if (updi_read_data(pgm, m->offset + m->size - 2, stored, 2) < 0) {
+    return -1;
+  }
+  if (memcmp(stored, m->buf + m->size - 2, 2) != 0) {
+    return 0;
+  }
+
+  /* already running, e.g. enabled by fuse: its result is stale */
+  if (updi_read_byte(pgm, UPDI_CRCSCAN_ADDRESS + UPDI_CRCSCAN_CTRLA, &value) < 0 ||
+      (value & (1 << UPDI_CRCSCAN_CTRLA_ENABLE))) {
+    return -1;
+  }
+  if (updi_write_byte(pgm, UPDI_CRCSCAN_ADDRESS + UPDI_CRCSCAN_CTRLB, UPDI_CRCSCAN_CTRLB_SRC_FLASH) < 0 ||
+      updi_write_byte(pgm, UPDI_CRCSCAN_ADDRESS + UPDI_CRCSCAN_CTRLA, 1 << UPDI_CRCSCAN_CTRLA_ENABLE) < 0) {
+    avrdude_message(MSG_INFO, "%s: Failed to start CRC scan\n", progname);
+    return -1;
+  }
+
+  gettimeofday (&tv, NULL);
+  start_time = (tv.tv_sec * 1000000) + tv.tv_usec;
+  do {
+    if (updi_read_byte(pgm, UPDI_CRCSCAN_ADDRESS + UPDI_CRCSCAN_STATUS, &value) < 0) {
+      return -1;
+    }
+    if (!(value & (1 << UPDI_CRCSCAN_STATUS_BUSY))) {
+      return (value & (1 << UPDI_CRCSCAN_STATUS_OK)) != 0;
+    }
+    gettimeofday (&tv, NULL);
+    current_time = (tv.tv_sec * 1000000) + tv.tv_usec;
+  } while ((current_time - start_time) < 1000000);
+
+  avrdude_message(MSG_INFO, "%s: Timeout waiting for CRC scan\n", progname);
   return -1;
 }
 
@@ -957,9 +1121,21 @@ void serialupdi_initpgm(PROGRAMMER * pgm)
   pgm->read_sib       = serialupdi_read_sib;
   pgm->paged_load     = serialupdi_paged_load;
   pgm->page_erase     = serialupdi_page_erase;
+  pgm->verify_crc     = serialupdi_verify_crc;
+  pgm->parseextparams = serialupdi_parseextparms;
   pgm->setup          = serialupdi_setup;
   pgm->teardown       = serialupdi_teardown;
 
+  /*
+   * The NVM controller is driven across the link.  A flash page costs
+   * a page buffer clear and a commit (address and data store each),
+   * the pointer store and data burst, and a status poll; the page
+   * erase rides along with the commit.  A chip erase costs the command
+   * and a status poll.
+   */
+  pgm->chip_erase_trips = 3;
+  pgm->page_erase_trips = 0;
+  pgm->page_write_trips = 7;
 }
 
 const char serialupdi_desc[] = "Driver for SerialUPDI programmers";
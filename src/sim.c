@@ -0,0 +1,446 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2022 The AVRDUDE authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * A simulated target: the memories of the part live in host memory,
+ * so complete sessions can be run without any hardware.  Page writes,
+ * erases and the link can be given a latency and a bandwidth, to see
+ * how the rest of avrdude behaves against slow and fast programmers.
+ *
+ * Flash behaves like flash: programming can only clear bits, so pages
+ * must have been erased before they can be written correctly.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "avrdude.h"
+#include "libavrdude.h"
+
+#include "sim.h"
+
+/*
+ * Private data for this programmer.
+ */
+struct pdata
+{
+  AVRPART * part;               /* the simulated device */
+  long write_delay;             /* us per page or byte write, -1 = part's */
+  long erase_delay;             /* us per page erase, -1 = part's */
+  long chip_erase_delay;        /* us per chip erase, -1 = part's */
+  long bandwidth;               /* link bytes/s, 0 = unlimited */
+  double busy;                  /* simulated time spent, us */
+  unsigned long pages_written, pages_erased, pages_read;
+};
+
+#define PDATA(pgm) ((struct pdata *)(pgm->cookie))
+
+
+static void sim_setup(PROGRAMMER * pgm)
+{
+  if ((pgm->cookie = malloc(sizeof(struct pdata))) == 0) {
+    avrdude_message(MSG_INFO, "%s: sim_setup(): Out of memory allocating private data\n",
+                    progname);
+    exit(1);
+  }
+  memset(pgm->cookie, 0, sizeof(struct pdata));
+}
+
+static void sim_teardown(PROGRAMMER * pgm)
+{
+  if (PDATA(pgm)->part != NULL)
+    avr_free_part(PDATA(pgm)->part);
+  free(pgm->cookie);
+}
+
+
+static int sim_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+  LNODEID ln;
+  const char *extended_param;
+  long * val;
+  long v;
+  int rv = 0;
+
+  for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+    extended_param = ldata(ln);
+
+    if (strcmp(extended_param, "part_delays") == 0) {
+      PDATA(pgm)->write_delay = -1;
+      PDATA(pgm)->erase_delay = -1;
+      PDATA(pgm)->chip_erase_delay = -1;
+      continue;
+    }
+
+    if (strncmp(extended_param, "write_delay=", 12) == 0)
+      val = &PDATA(pgm)->write_delay;
+    else if (strncmp(extended_param, "erase_delay=", 12) == 0)
+      val = &PDATA(pgm)->erase_delay;
+    else if (strncmp(extended_param, "chip_erase_delay=", 17) == 0)
+      val = &PDATA(pgm)->chip_erase_delay;
+    else if (strncmp(extended_param, "bandwidth=", 10) == 0)
+      val = &PDATA(pgm)->bandwidth;
+    else {
+      avrdude_message(MSG_INFO, "%s: sim_parseextparms(): invalid extended parameter '%s'\n",
+                      progname, extended_param);
+      rv = -1;
+      continue;
+    }
+
+    if (sscanf(strchr(extended_param, '=') + 1, "%li", &v) != 1 || v < 0) {
+      avrdude_message(MSG_INFO, "%s: sim_parseextparms(): invalid value in '%s'\n",
+                      progname, extended_param);
+      rv = -1;
+      continue;
+    }
+    *val = v;
+  }
+
+  return rv;
+}
+
+
+/*
+ * Spend the time the operation would take on the target: 'us' for
+ * the device to complete it, plus moving 'nbytes' over the link.
+ */
+static void sim_delay(PROGRAMMER * pgm, long us, unsigned int nbytes)
+{
+  double t = us;
+
+  if (PDATA(pgm)->bandwidth > 0)
+    t += nbytes * 1e6 / PDATA(pgm)->bandwidth;
+  PDATA(pgm)->busy += t;
+  if (t >= 1)
+    usleep((unsigned int) t);
+}
+
+
+static long sim_write_delay(PROGRAMMER * pgm, AVRMEM * m)
+{
+  return PDATA(pgm)->write_delay < 0? m->max_write_delay: PDATA(pgm)->write_delay;
+}
+
+
+/*
+ * Find the simulated counterpart of m, and the offset of m within it.
+ * The Xmega application, apptable and boot sections are views into
+ * the flash, so they all map onto the simulated flash.
+ */
+static AVRMEM * sim_locate(PROGRAMMER * pgm, AVRMEM * m, unsigned int * base)
+{
+  AVRMEM * flash;
+
+  *base = 0;
+  if (PDATA(pgm)->part == NULL) {
+    avrdude_message(MSG_INFO, "%s: sim: device not initialized\n", progname);
+    return NULL;
+  }
+
+  flash = avr_locate_mem(PDATA(pgm)->part, "flash");
+  if (flash != NULL && avr_mem_is_flash_type(m) &&
+      m->offset >= flash->offset) {
+    *base = m->offset - flash->offset;
+    return flash;
+  }
+
+  return avr_locate_mem(PDATA(pgm)->part, m->desc);
+}
+
+
+static int sim_open(PROGRAMMER * pgm, char * port)
+{
+  strcpy(pgm->port, port);
+
+  return 0;
+}
+
+
+static void sim_close(PROGRAMMER * pgm)
+{
+  avrdude_message(MSG_NOTICE, "%s: sim: %lu pages written, %lu erased, %lu read, "
+                  "%.3f s simulated busy time\n",
+                  progname, PDATA(pgm)->pages_written, PDATA(pgm)->pages_erased,
+                  PDATA(pgm)->pages_read, PDATA(pgm)->busy / 1e6);
+}
+
+
+static void sim_display(PROGRAMMER * pgm, const char * p)
+{
+  avrdude_message(MSG_INFO, "%sWrite delay       : ", p);
+  if (PDATA(pgm)->write_delay < 0)
+    avrdude_message(MSG_INFO, "from part\n");
+  else
+    avrdude_message(MSG_INFO, "%ld us\n", PDATA(pgm)->write_delay);
+  avrdude_message(MSG_INFO, "%sErase delay       : ", p);
+  if (PDATA(pgm)->erase_delay < 0)
+    avrdude_message(MSG_INFO, "from part\n");
+  else
+    avrdude_message(MSG_INFO, "%ld us\n", PDATA(pgm)->erase_delay);
+  avrdude_message(MSG_INFO, "%sBandwidth         : ", p);
+  if (PDATA(pgm)->bandwidth == 0)
+    avrdude_message(MSG_INFO, "unlimited\n");
+  else
+    avrdude_message(MSG_INFO, "%ld bytes/s\n", PDATA(pgm)->bandwidth);
+}
+
+
+static void sim_enable(PROGRAMMER * pgm)
+{
+}
+
+
+static void sim_disable(PROGRAMMER * pgm)
+{
+}
+
+
+static int sim_program_enable(PROGRAMMER * pgm, AVRPART * p)
+{
+  return 0;
+}
+
+
+/*
+ * Bring up a blank device of the selected part: all memories read as
+ * 0xff, except for the signature.
+ */
+static int sim_initialize(PROGRAMMER * pgm, AVRPART * p)
+{
+  LNODEID ln;
+  AVRMEM * m;
+
+  if (PDATA(pgm)->part != NULL)
+    avr_free_part(PDATA(pgm)->part);
+  PDATA(pgm)->part = avr_dup_part(p);
+
+  for (ln = lfirst(PDATA(pgm)->part->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    memset(m->buf, 0xff, m->size);
+    if (strcasecmp(m->desc, "signature") == 0)
+      memcpy(m->buf, p->signature, m->size < 3? m->size: 3);
+  }
+
+  return 0;
+}
+
+
+static int sim_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
+                   unsigned char *res)
+{
+  avrdude_message(MSG_INFO, "%s: sim: raw ISP commands are not simulated\n",
+                  progname);
+  return -1;
+}
+
+
+static int sim_chip_erase(PROGRAMMER * pgm, AVRPART * p)
+{
+  LNODEID ln;
+  AVRMEM * m;
+
+  if (PDATA(pgm)->part == NULL)
+    return -1;
+
+  for (ln = lfirst(PDATA(pgm)->part->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    if (avr_mem_is_flash_type(m) || strcasecmp(m->desc, "eeprom") == 0)
+      memset(m->buf, 0xff, m->size);
+  }
+  sim_delay(pgm, PDATA(pgm)->chip_erase_delay < 0?
+            p->chip_erase_delay: PDATA(pgm)->chip_erase_delay, 1);
+
+  return 0;
+}
+
+
+static int sim_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned int baseaddr)
+{
+  AVRMEM * sm;
+  unsigned int base;
+
+  if ((sm = sim_locate(pgm, m, &base)) == NULL)
+    return -1;
+  if (base + baseaddr + m->page_size > sm->size)
+    return -1;
+
+  memset(sm->buf + base + baseaddr, 0xff, m->page_size);
+  PDATA(pgm)->pages_erased++;
+  sim_delay(pgm, PDATA(pgm)->erase_delay < 0?
+            m->max_write_delay: PDATA(pgm)->erase_delay, 4);
+
+  return 0;
+}
+
+
+/*
+ * Program n bytes of data into the simulated memory.  Flash can only
+ * go from 1 to 0; everything else is simply overwritten.
+ */
+static void sim_program(AVRMEM * sm, unsigned int addr,
+                        const unsigned char * data, unsigned int n)
+{
+  unsigned int i;
+
+  if (avr_mem_is_flash_type(sm)) {
+    for (i = 0; i < n; i++)
+      sm->buf[addr + i] &= data[i];
+  } else {
+    memcpy(sm->buf + addr, data, n);
+  }
+}
+
+
+static int sim_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                           unsigned int page_size,
+                           unsigned int addr, unsigned int n_bytes)
+{
+  AVRMEM * sm;
+  unsigned int base;
+
+  if ((sm = sim_locate(pgm, m, &base)) == NULL)
+    return -1;
+  if (addr + n_bytes > m->size)
+    n_bytes = m->size - addr;
+  if (base + addr + n_bytes > sm->size)
+    return -1;
+
+  sim_program(sm, base + addr, m->buf + addr, n_bytes);
+  PDATA(pgm)->pages_written += (n_bytes + page_size - 1) / page_size;
+  sim_delay(pgm, sim_write_delay(pgm, m) * ((n_bytes + page_size - 1) / page_size),
+            n_bytes);
+
+  return n_bytes;
+}
+
+
+static int sim_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned int page_size,
+                          unsigned int addr, unsigned int n_bytes)
+{
+  AVRMEM * sm;
+  unsigned int base;
+
+  if ((sm = sim_locate(pgm, m, &base)) == NULL)
+    return -1;
+  if (addr + n_bytes > m->size)
+    n_bytes = m->size - addr;
+  if (base + addr + n_bytes > sm->size)
+    return -1;
+
+  memcpy(m->buf + addr, sm->buf + base + addr, n_bytes);
+  PDATA(pgm)->pages_read += (n_bytes + page_size - 1) / page_size;
+  sim_delay(pgm, 0, n_bytes);
+
+  return n_bytes;
+}
+
+
+static int sim_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned long addr, unsigned char value)
+{
+  AVRMEM * sm;
+  unsigned int base;
+
+  if ((sm = sim_locate(pgm, m, &base)) == NULL)
+    return -1;
+  if (base + addr >= sm->size)
+    return -1;
+
+  sim_program(sm, base + addr, &value, 1);
+  sim_delay(pgm, sim_write_delay(pgm, m), 4);
+
+  return 0;
+}
+
+
+static int sim_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                         unsigned long addr, unsigned char * value)
+{
+  AVRMEM * sm;
+  unsigned int base;
+
+  if ((sm = sim_locate(pgm, m, &base)) == NULL)
+    return -1;
+  if (base + addr >= sm->size)
+    return -1;
+
+  *value = sm->buf[base + addr];
+  sim_delay(pgm, 0, 4);
+
+  return 0;
+}
+
+
+static int sim_read_sig_bytes(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+  AVRMEM * sm;
+  unsigned int base;
+
+  if ((sm = sim_locate(pgm, m, &base)) == NULL)
+    return -1;
+
+  memcpy(m->buf, sm->buf, m->size < sm->size? m->size: sm->size);
+  sim_delay(pgm, 0, 3);
+
+  return 3;
+}
+
+const char sim_desc[] = "Simulated target in host memory, for testing and benchmarking";
+
+void sim_initpgm(PROGRAMMER * pgm)
+{
+  strcpy(pgm->type, "sim");
+
+  /*
+   * mandatory functions
+   */
+  pgm->initialize     = sim_initialize;
+  pgm->display        = sim_display;
+  pgm->enable         = sim_enable;
+  pgm->disable        = sim_disable;
+  pgm->program_enable = sim_program_enable;
+  pgm->chip_erase     = sim_chip_erase;
+  pgm->cmd            = sim_cmd;
+  pgm->open           = sim_open;
+  pgm->close          = sim_close;
+
+  /*
+   * optional functions
+   */
+
+  pgm->write_byte = sim_write_byte;
+  pgm->read_byte = sim_read_byte;
+
+  pgm->paged_write = sim_paged_write;
+  pgm->paged_load = sim_paged_load;
+  pgm->page_erase = sim_page_erase;
+
+  pgm->read_sig_bytes = sim_read_sig_bytes;
+
+  pgm->parseextparams = sim_parseextparms;
+  pgm->setup          = sim_setup;
+  pgm->teardown       = sim_teardown;
+}
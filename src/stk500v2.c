@@ -4311,6 +4311,81 @@ static int stk600_xprog_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     return 0;
 }
 
+/*
+ * Checksums of a flash image, as computed by the Xmega NVM controller
+ * on its CRC commands.  Early Xmega devices use a 24-bit CRC over the
+ * flash words, later ones (with a CRC peripheral) a standard CRC-32 of
+ * which XPROG returns the lower 24 bits.
+ */
+static unsigned long stk600_xprog_crc24(const unsigned char *buf, unsigned int len)
+{
+    unsigned long crc = 0;
+    unsigned int i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        crc <<= 1;
+        if (crc & 0x1000000)
+            crc ^= 0x80001b;
+        crc ^= buf[i] | (buf[i + 1] << 8);
+        crc &= 0xffffff;
+    }
+    return crc;
+}
+
+static unsigned long stk600_xprog_crc32(const unsigned char *buf, unsigned int len)
+{
+    unsigned long crc = 0xffffffff;
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (crc & 1? 0xedb88320: 0);
+    }
+    return ~crc & 0xffffffff;
+}
+
+/*
+ * Have the device compute the CRC over an entire flash section, and
+ * compare it against the one of the buffer contents.
+ *
+ * Return 1 if they match, 0 if not, or -1 if no CRC is available for
+ * this memory.
+ */
+static int stk600_xprog_verify_crc(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+    unsigned char b[5];
+    unsigned long devcrc;
+
+    if (!(p->flags & AVRPART_HAS_PDI))
+        return -1;
+
+    if (strcmp(m->desc, "application") == 0) {
+        b[1] = XPRG_CRC_APP;
+    } else if (strcmp(m->desc, "boot") == 0) {
+        b[1] = XPRG_CRC_BOOT;
+    } else if (strcmp(m->desc, "flash") == 0) {
+        b[1] = XPRG_CRC_FLASH;
+    } else {
+        return -1;
+    }
+
+    b[0] = XPRG_CMD_CRC;
+    if (stk600_xprog_command(pgm, b, 2, 5) < 0 || b[1] != XPRG_ERR_OK) {
+        avrdude_message(MSG_NOTICE, "%s: stk600_xprog_verify_crc(): XPRG_CMD_CRC failed\n",
+                        progname);
+        return -1;
+    }
+    devcrc = ((unsigned long)b[2] << 16) | (b[3] << 8) | b[4];
+
+    avrdude_message(MSG_NOTICE, "%s: stk600_xprog_verify_crc(): device CRC 0x%06lx\n",
+                    progname, devcrc);
+
+    return devcrc == stk600_xprog_crc24(m->buf, m->size) ||
+        devcrc == (stk600_xprog_crc32(m->buf, m->size) & 0xffffff);
+}
+
 /*
  * Modify pgm's methods for XPROG operation.
  */
@@ -4324,6 +4399,7 @@ static void stk600_setup_xprog(PROGRAMMER * pgm)
     pgm->paged_write = stk600_xprog_paged_write;
     pgm->page_erase = stk600_xprog_page_erase;
     pgm->chip_erase = stk600_xprog_chip_erase;
+    pgm->verify_crc = stk600_xprog_verify_crc;
 }
 
 
@@ -4340,6 +4416,7 @@ static void stk600_setup_isp(PROGRAMMER * pgm)
     pgm->paged_write = stk500v2_paged_write;
     pgm->page_erase = stk500v2_page_erase;
     pgm->chip_erase = stk500v2_chip_erase;
+    pgm->verify_crc = NULL;
 }
 
 const char stk500v2_desc[] = "Atmel STK500 Version 2.x firmware";
@@ -89,6 +89,9 @@ static int cmd_pgm   (PROGRAMMER * pgm, struct avrpart * p,
 static int cmd_verbose (PROGRAMMER * pgm, struct avrpart * p,
 		      int argc, char *argv[]);
 
+static int cmd_stats (PROGRAMMER * pgm, struct avrpart * p,
+		      int argc, char *argv[]);
+
 struct command cmd[] = {
   { "dump",  cmd_dump,  "dump memory  : %s <memtype> <addr> <N-Bytes>" },
   { "read",  cmd_dump,  "alias for dump" },
@@ -105,6 +108,7 @@ struct command cmd[] = {
   { "spi",   cmd_spi,   "enter direct SPI mode" },
   { "pgm",   cmd_pgm,   "return to programming mode" },
   { "verbose", cmd_verbose, "change verbosity" },
+  { "stats", cmd_stats, "serial traffic statistics : %s [reset]" },
   { "help",  cmd_help,  "help" },
   { "?",     cmd_help,  "help" },
   { "quit",  cmd_quit,  "quit" }
@@ -784,6 +788,22 @@ static int cmd_verbose(PROGRAMMER * pgm, struct avrpart * p,
   return 0;
 }
 
+static int cmd_stats(PROGRAMMER * pgm, struct avrpart * p,
+		     int argc, char * argv[])
+{
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset") != 0)) {
+    avrdude_message(MSG_INFO, "Usage: stats [reset]\n");
+    return -1;
+  }
+  if (argc == 2) {
+    serial_stats_reset();
+    return 0;
+  }
+  serial_stats_report();
+
+  return 0;
+}
+
 static int tokenize(char * s, char *** argv)
 {
   int     i, n, l, k, nargs, offset;
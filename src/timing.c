@@ -0,0 +1,239 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2022 The AVRDUDE authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Wall clock time spent in the phases of a session (config parsing,
+ * opening the port, sync, signature, erase, every -U operation, ...)
+ * together with the bytes and pages each phase moved and the number
+ * of serial round trips it took.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "avrdude.h"
+#include "libavrdude.h"
+
+#define TIMING_MAX_PHASES 64
+
+struct timing_phase {
+  char          name[32];
+  double        start;          /* seconds */
+  double        elapsed;        /* seconds, < 0 while running */
+  long          bytes;
+  int           pages;
+  unsigned long trips;          /* serial_stats.round_trips at start, then delta */
+};
+
+int timing_enabled;
+
+static struct timing_phase phases[TIMING_MAX_PHASES];
+static int nphases;
+static int current = -1;
+
+
+/*
+ * Monotonic time in seconds.
+ */
+double timing_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*
+ * Start timing a new phase, closing the one that is still running.
+ * Returns a handle for timing_end(), or -1 if timing is off or the
+ * table is full.
+ */
+int timing_begin(const char * fmt, ...)
+{
+  struct timing_phase * ph;
+  va_list ap;
+
+  if (!timing_enabled || nphases >= TIMING_MAX_PHASES)
+    return -1;
+
+  if (current >= 0)
+    timing_end(current);
+
+  ph = &phases[nphases];
+  va_start(ap, fmt);
+  vsnprintf(ph->name, sizeof(ph->name), fmt, ap);
+  va_end(ap);
+  ph->elapsed = -1;
+  ph->bytes = 0;
+  ph->pages = 0;
+  ph->trips = serial_stats.round_trips;
+  ph->start = timing_now();
+
+  return current = nphases++;
+}
+
+
+/*
+ * Credit bytes and pages to the running phase.
+ */
+void timing_count(long bytes, int pages)
+{
+  if (current < 0)
+    return;
+
+  phases[current].bytes += bytes;
+  phases[current].pages += pages;
+}
+
+
+void timing_end(int handle)
+{
+  struct timing_phase * ph;
+
+  if (handle < 0 || handle >= nphases)
+    return;
+
+  ph = &phases[handle];
+  if (ph->elapsed >= 0)
+    return;
+
+  ph->elapsed = timing_now() - ph->start;
+  ph->trips = serial_stats.round_trips - ph->trips;
+  if (current == handle)
+    current = -1;
+}
+
+
+static void json_string(FILE * f, const char * s)
+{
+  fputc('"', f);
+  for (; s && *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      fprintf(f, "\\u%04x", (unsigned char) *s);
+    else
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+
+/*
+ * Print the phase table.  The text form goes through avrdude_message()
+ * like any other output; the JSON form is a single line written to f,
+ * so repeated runs can append to the same file.
+ */
+void timing_report(FILE * f, int json, const char * programmer,
+                   const char * part, const char * port)
+{
+  struct timing_phase * ph;
+  double total = 0;
+  long bytes = 0;
+  int pages = 0;
+  unsigned long trips = 0;
+  const char * sep;
+  int i;
+
+  if (!timing_enabled)
+    return;
+
+  if (current >= 0)
+    timing_end(current);
+
+  if (json) {
+    fprintf(f, "{\"programmer\":");
+    json_string(f, programmer);
+    fprintf(f, ",\"part\":");
+    json_string(f, part);
+    fprintf(f, ",\"port\":");
+    json_string(f, port);
+    fprintf(f, ",\"phases\":[");
+  } else {
+    avrdude_message(MSG_INFO, "\n%s: timing (trips are sends answered by a receive)\n"
+                    "%s  %-16s %10s %8s %6s %6s %10s %9s\n",
+                    progname, progbuf, "phase", "ms", "bytes", "pages",
+                    "trips", "bytes/s", "ms/page");
+  }
+
+  for (i = 0; i < nphases; i++) {
+    ph = &phases[i];
+    total += ph->elapsed;
+    bytes += ph->bytes;
+    pages += ph->pages;
+    trips += ph->trips;
+
+    if (json) {
+      fprintf(f, "%s{\"name\":", i? ",": "");
+      json_string(f, ph->name);
+      fprintf(f, ",\"ms\":%.3f,\"bytes\":%ld,\"pages\":%d,\"round_trips\":%lu}",
+              ph->elapsed * 1e3, ph->bytes, ph->pages, ph->trips);
+      continue;
+    }
+
+    avrdude_message(MSG_INFO, "%s  %-16s %10.2f", progbuf, ph->name,
+                    ph->elapsed * 1e3);
+    if (ph->bytes || ph->pages || ph->trips)
+      avrdude_message(MSG_INFO, " %8ld %6d %6lu", ph->bytes, ph->pages,
+                      ph->trips);
+    if (ph->bytes && ph->elapsed > 0)
+      avrdude_message(MSG_INFO, " %10.0f", ph->bytes / ph->elapsed);
+    if (ph->pages)
+      avrdude_message(MSG_INFO, " %9.3f", ph->elapsed * 1e3 / ph->pages);
+    avrdude_message(MSG_INFO, "\n");
+  }
+
+  if (json) {
+    fprintf(f, "],\"total_ms\":%.3f,\"bytes\":%ld,\"pages\":%d,"
+            "\"round_trips\":%lu,", total * 1e3, bytes, pages, trips);
+    fprintf(f, "\"serial\":{\"sends\":%lu,\"recvs\":%lu,\"bytes_sent\":%lu,"
+            "\"bytes_received\":%lu,\"timeouts\":%lu,\"retries\":%lu,"
+            "\"latency_us\":[",
+            serial_stats.sends, serial_stats.recvs, serial_stats.bytes_sent,
+            serial_stats.bytes_received, serial_stats.timeouts,
+            serial_stats.retries);
+    for (i = 0, sep = ""; i < SERIAL_LATENCY_BUCKETS; i++) {
+      if (serial_stats.latency[i] == 0)
+        continue;
+      fprintf(f, "%s{\"min\":%lu,\"count\":%lu}", sep,
+              serial_latency_min(i), serial_stats.latency[i]);
+      sep = ",";
+    }
+    fprintf(f, "]}}\n");
+    fflush(f);
+  } else {
+    avrdude_message(MSG_INFO, "%s  %-16s %10.2f %8ld %6d %6lu\n",
+                    progbuf, "total", total * 1e3, bytes, pages, trips);
+    if (serial_stats.sends || serial_stats.recvs)
+      serial_stats_report();
+  }
+}
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include "avrdude.h"
@@ -212,10 +213,31 @@ void free_update(UPDATE * u)
 }
 
 
+/*
+ * Number of pages of m within the first size bytes, counting only
+ * those with data from the input file if 'tagged' is set.  The Xmega
+ * and UPDI flash lack the "paged" flag but are still written a page
+ * at a time, so only the page size matters here.
+ */
+static int do_op_pages(AVRMEM * m, int size, int tagged)
+{
+  int addr, n;
+
+  if (m->page_size <= 1)
+    return 0;
+
+  for (n = 0, addr = 0; addr < size && addr < m->size; addr += m->page_size)
+    if (!tagged || avr_mem_tagged(m, addr, m->page_size))
+      n++;
+
+  return n;
+}
+
+
 int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags flags)
 {
-  struct avrpart * v;
-  AVRMEM * mem;
+  AVRMEM * mem, * vmem;
+  int nbad, nskipped, npages;
   int size, vsize;
   int rc;
 
@@ -249,6 +271,7 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
     }
     report_progress(1,1,NULL);
     size = rc;
+    timing_count(size, do_op_pages(mem, size, 0));
 
     if (quell_progress < 2) {
       if (rc == 0)
@@ -292,9 +315,19 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
 	  }
 
     if (!(flags & UF_NOWRITE)) {
+      npages = do_op_pages(mem, size, 1);
       report_progress(0,1,"Writing");
-      rc = avr_write(pgm, p, upd->memtype, size, (flags & UF_AUTO_ERASE) != 0);
+      rc = avr_write_mem(pgm, p, mem, size, (flags & UF_AUTO_ERASE) != 0,
+                         (flags & UF_INCREMENTAL) != 0,
+                         (flags & UF_ERASED) != 0, &nskipped);
       report_progress(1,1,NULL);
+      if (rc >= 0 && nskipped > 0 && quell_progress < 2) {
+        avrdude_message(MSG_INFO, "%s: %d %s %s pages skipped, %d bytes not written\n",
+              progname, nskipped, (flags & UF_ERASED)? "blank": "unchanged",
+              mem->desc, nskipped * mem->page_size);
+      }
+      if (rc >= 0)
+        timing_count(rc, npages - nskipped);
     }
     else {
       /*
@@ -339,8 +372,52 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
               progname, upd->filename);
       return -1;
     }
-    v = avr_dup_part(p);
     size = rc;
+
+    /*
+     * Let the device checksum the memory if it can; only read it
+     * back if that does not match.
+     */
+    if ((flags & UF_CRC_VERIFY) && pgm->verify_crc != NULL) {
+      rc = pgm->verify_crc(pgm, p, mem);
+      if (rc > 0) {
+        if (quell_progress < 2) {
+          avrdude_message(MSG_INFO, "%s: %s memory CRC matches, %d bytes of %s verified\n",
+                  progname, mem->desc, size, mem->desc);
+        }
+        timing_count(size, 0);
+        pgm->vfy_led(pgm, OFF);
+        return 0;
+      }
+      if (rc == 0 && quell_progress < 2) {
+        avrdude_message(MSG_INFO, "%s: %s memory CRC mismatch, reading back\n",
+                progname, mem->desc);
+      }
+    }
+
+    /*
+     * Hand the file contents over to a bare image of just this
+     * memory, and read the device into a fresh buffer of the part.
+     * The allocation extents are shared, they serve as the read
+     * mask and are left in place in mem.
+     */
+    vmem = avr_new_memtype();
+    vmem->size = mem->size;
+    vmem->buf = mem->buf;
+    vmem->extents = mem->extents;
+    vmem->n_extents = mem->n_extents;
+    vmem->max_extents = mem->max_extents;
+    mem->buf = (unsigned char *)malloc(mem->size);
+    if (mem->buf == NULL) {
+      avrdude_message(MSG_INFO, "%s: out of memory allocating %d bytes for verification\n",
+              progname, mem->size);
+      mem->buf = vmem->buf;
+      vmem->buf = NULL;
+      vmem->extents = NULL;
+      avr_free_mem(vmem);
+      return -1;
+    }
+
     if (quell_progress < 2) {
       avrdude_message(MSG_INFO, "%s: input file %s contains %d bytes\n",
             progname, upd->filename, size);
@@ -348,30 +425,31 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
             progname, mem->desc);
     }
 
+    /*
+     * Compare each page as soon as it has been read, so a mismatch
+     * stops the read right there (unless all mismatches have been
+     * asked for).
+     */
     report_progress (0,1,"Reading");
-    rc = avr_read(pgm, p, upd->memtype, v);
-    if (rc < 0) {
-      avrdude_message(MSG_INFO, "%s: failed to read all of %s memory, rc=%d\n",
-              progname, mem->desc, rc);
+    rc = avr_verify_stream(pgm, p, mem, vmem, size,
+                           (flags & UF_VERIFY_ALL) != 0, &nbad);
+    report_progress (1,1,NULL);
+    vmem->extents = NULL;
+    avr_free_mem(vmem);
+    if (nbad > 0) {
+      avrdude_message(MSG_INFO, "%s: verification error; content mismatch\n",
+              progname);
       pgm->err_led(pgm, ON);
-      avr_free_part(v);
       return -1;
     }
-    report_progress (1,1,NULL);
-
-
-
-    if (quell_progress < 2) {
-      avrdude_message(MSG_INFO, "%s: verifying ...\n", progname);
-    }
-    rc = avr_verify(p, v, upd->memtype, size);
     if (rc < 0) {
-      avrdude_message(MSG_INFO, "%s: verification error; content mismatch\n",
-              progname);
+      avrdude_message(MSG_INFO, "%s: failed to read all of %s memory, rc=%d\n",
+              progname, mem->desc, rc);
       pgm->err_led(pgm, ON);
-      avr_free_part(v);
       return -1;
     }
+    rc = size < mem->size? size: mem->size;
+    timing_count(rc, do_op_pages(mem, rc, 1));
 
     if (quell_progress < 2) {
       avrdude_message(MSG_INFO, "%s: %d bytes of %s verified\n",
@@ -379,7 +457,6 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
     }
 
     pgm->vfy_led(pgm, OFF);
-    avr_free_part(v);
   }
   else {
     avrdude_message(MSG_INFO, "%s: invalid update operation (%d) requested\n",
@@ -390,3 +467,133 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
   return 0;
 }
 
+
+/*
+ * Shortest chip erase and page write times in the datasheets, for the
+ * parts that leave chip_erase_delay or max_write_delay unset (UPDI).
+ */
+#define PLAN_CHIP_ERASE_MIN_US 4000
+#define PLAN_PAGE_WRITE_MIN_US 2000
+
+/*
+ * Time the cheapest command we have, a signature byte read, to learn
+ * the round trip time of the programmer in microseconds.
+ */
+static double plan_round_trip(PROGRAMMER * pgm, struct avrpart * p)
+{
+  AVRMEM * m;
+  struct timeval tv0, tv1;
+  unsigned char b;
+  double t, best = -1;
+  int i;
+
+  m = avr_locate_mem(p, "signature");
+  if (m == NULL || pgm->read_byte == NULL)
+    return 0;
+
+  for (i = 0; i < 3; i++) {
+    gettimeofday(&tv0, NULL);
+    if (pgm->read_byte(pgm, p, m, 0, &b) != 0)
+      return 0;
+    gettimeofday(&tv1, NULL);
+    t = (tv1.tv_sec - tv0.tv_sec) * 1e6 + (tv1.tv_usec - tv0.tv_usec);
+    if (best < 0 || t < best)
+      best = t;
+  }
+
+  return best;
+}
+
+
+/*
+ * Decide whether the -U write operations in 'updates' are cheaper
+ * done after one chip erase, or with an erase of each page before it
+ * is written.  The files are read to count the pages to be written;
+ * do_op() reads them again later.
+ *
+ * Returns ERASE_PLAN_CHIP or ERASE_PLAN_PAGE, or -1 if there is no
+ * flash to write or the files cannot be read ahead, in which case the
+ * caller should stick to its fixed policy.
+ */
+int plan_erase(PROGRAMMER * pgm, struct avrpart * p, LISTID updates)
+{
+  LNODEID ln;
+  UPDATE * upd;
+  AVRMEM * m, * ee;
+  unsigned int addr, i;
+  int npages, nblank, nflash, nwrite, ee_full;
+  int write_delay, chip_delay;
+  double rtt, chip_cost, page_cost;
+
+  ee = avr_locate_mem(p, "eeprom");
+  ee_full = 0;
+  npages = nblank = nflash = 0;
+  write_delay = 0;
+
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    if (upd->op != DEVICE_WRITE)
+      continue;
+    m = avr_locate_mem(p, upd->memtype);
+    if (m == NULL || (!avr_mem_is_flash_type(m) && m != ee))
+      continue;
+    if (strcmp(upd->filename, "-") == 0)
+      return -1;
+    if (fileio(FIO_READ, upd->filename, upd->format, p, upd->memtype, -1) < 0)
+      return -1;
+
+    if (m == ee) {
+      ee_full = m->n_extents == 1 && m->extents[0].start == 0 &&
+        m->extents[0].end >= m->size;
+    } else {
+      nflash++;
+      if (m->max_write_delay > write_delay)
+        write_delay = m->max_write_delay;
+      for (addr = 0; addr < m->size; addr += m->page_size) {
+        if (!avr_mem_tagged(m, addr, m->page_size))
+          continue;
+        npages++;
+        for (i = addr; i < addr + m->page_size && i < m->size; i++)
+          if (m->buf[i] != 0xff)
+            break;
+        if (i == addr + m->page_size || i == m->size)
+          nblank++;
+      }
+    }
+    avr_mem_untag_all(m);
+  }
+
+  if (nflash == 0)
+    return -1;
+
+  /*
+   * A page costs a command for its erase and one for its write, and
+   * both take about the same time to complete.  After a chip erase,
+   * the blank pages need not be written at all, unless the programmer
+   * cannot tell that the erase really happened.
+   */
+  chip_delay = p->chip_erase_delay > 0? p->chip_erase_delay: PLAN_CHIP_ERASE_MIN_US;
+  if (write_delay <= 0)
+    write_delay = PLAN_PAGE_WRITE_MIN_US;
+  nwrite = pgm->erase_blanks? npages - nblank: npages;
+
+  rtt = plan_round_trip(pgm, p);
+  chip_cost = chip_delay + pgm->chip_erase_trips * rtt +
+    nwrite * (write_delay + pgm->page_write_trips * rtt);
+  page_cost = npages * (2 * write_delay +
+                        (pgm->page_erase_trips + pgm->page_write_trips) * rtt);
+
+  avrdude_message(MSG_NOTICE, "%s: erase planner: %d pages (%d blank), round trip %.0f us,\n"
+                  "%schip erase %.0f us, page erase %.0f us\n",
+                  progname, npages, nblank, rtt, progbuf, chip_cost, page_cost);
+
+  /*
+   * Xmega devices have always kept their EEPROM here, as the chip
+   * erase also clears it unless EESAVE is programmed.  Only switch to
+   * a chip erase if the EEPROM is being rewritten in full anyway.
+   */
+  if ((p->flags & AVRPART_HAS_PDI) && ee != NULL && !ee_full)
+    return ERASE_PLAN_PAGE;
+
+  return chip_cost <= page_cost? ERASE_PLAN_CHIP: ERASE_PLAN_PAGE;
+}
@@ -82,6 +82,9 @@
 #define UPDI_ASI_CRC_STATUS 0x0C
 
 #define UPDI_CTRLA_IBDLY_BIT    7
+#define UPDI_CTRLA_RSD_BIT      3
+#define UPDI_CTRLA_GTVAL_128    0x00
+#define UPDI_CTRLA_GTVAL_16     0x03
 #define UPDI_CTRLB_CCDETDIS_BIT 3
 #define UPDI_CTRLB_UPDIDIS_BIT  2
 
@@ -104,6 +107,8 @@
 
 #define UPDI_ASI_SYS_CTRLA_UROW_FINAL  1
 
+#define UPDI_ASI_CTRLA_UPDICLKSEL_16M  0x01
+
 #define UPDI_RESET_REQ_VALUE  0x59
 
 // FLASH CONTROLLER
@@ -153,4 +158,15 @@
 #define UPDI_NVM_STATUS_EEPROM_BUSY 1
 #define UPDI_NVM_STATUS_FLASH_BUSY  0
 
+// CRCSCAN peripheral
+#define UPDI_CRCSCAN_ADDRESS  0x0120
+#define UPDI_CRCSCAN_CTRLA    0x00
+#define UPDI_CRCSCAN_CTRLB    0x01
+#define UPDI_CRCSCAN_STATUS   0x02
+
+#define UPDI_CRCSCAN_CTRLA_ENABLE  0
+#define UPDI_CRCSCAN_CTRLB_SRC_FLASH 0x00
+#define UPDI_CRCSCAN_STATUS_OK     1
+#define UPDI_CRCSCAN_STATUS_BUSY   0
+
 #endif /* updi_constants_h */
@@ -68,6 +68,17 @@ static int updi_physical_open(PROGRAMMER* pgm, int baudrate, unsigned long cflag
   return 0;
 }
 
+static int updi_physical_set_baud(PROGRAMMER * pgm, long baudrate)
+{
+  avrdude_message(MSG_DEBUG, "%s: Switching to %ld baud\n", progname, baudrate);
+
+  if (serial_setparams(&pgm->fd, baudrate, SERIAL_8E2) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: Setting %ld baud failed\n", progname, baudrate);
+    return -1;
+  }
+  return 0;
+}
+
 static void updi_physical_close(PROGRAMMER* pgm)
 {
   serial_close(&pgm->fd);
@@ -93,6 +104,44 @@ static int updi_physical_send(PROGRAMMER * pgm, unsigned char * buf, size_t len)
   return rv;
 }
 
+/*
+ * Send a block the target does not respond to, and check that the echo
+ * of every byte comes back unchanged.  A short or corrupted echo means
+ * the target drove the line while we were sending.
+ */
+static int updi_physical_send_echoed(PROGRAMMER * pgm, unsigned char * buf, size_t len)
+{
+  unsigned char * echo;
+  int rv;
+
+  avrdude_message(MSG_DEBUG, "%s: Sending %lu bytes without response\n", progname, len);
+
+  echo = malloc(len);
+  if (echo == NULL) {
+    avrdude_message(MSG_DEBUG, "%s: Allocating echo buffer failed\n", progname);
+    return -1;
+  }
+
+  rv = serial_send(&pgm->fd, buf, len);
+  if (rv < 0) {
+    free(echo);
+    return -1;
+  }
+  if (serial_recv(&pgm->fd, echo, len) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: Echo of %lu bytes not received\n", progname, len);
+    free(echo);
+    return -1;
+  }
+  if (memcmp(buf, echo, len) != 0) {
+    avrdude_message(MSG_DEBUG, "%s: Echo does not match data sent\n", progname);
+    free(echo);
+    return -1;
+  }
+
+  free(echo);
+  return rv;
+}
+
 static int updi_physical_recv(PROGRAMMER * pgm, unsigned char * buf, size_t len)
 {
   size_t i;
@@ -186,6 +235,15 @@ void updi_link_close(PROGRAMMER * pgm)
   updi_physical_close(pgm);
 }
 
+/*
+ * CTRLA for the session: inter-byte delay on, and the guard time
+ * currently in use.
+ */
+static uint8_t updi_link_ctrla(PROGRAMMER * pgm)
+{
+  return (1 << UPDI_CTRLA_IBDLY_BIT) | updi_get_guard_time(pgm);
+}
+
 static int updi_link_init_session_parameters(PROGRAMMER * pgm) 
 {
 /*
@@ -200,7 +258,7 @@ static int updi_link_init_session_parameters(PROGRAMMER * pgm)
     return -1;
   }
 
-  if (updi_link_stcs(pgm, UPDI_CS_CTRLA, 1 << UPDI_CTRLA_IBDLY_BIT) < 0) {
+  if (updi_link_stcs(pgm, UPDI_CS_CTRLA, updi_link_ctrla(pgm)) < 0) {
     return -1;
   }
 
@@ -242,6 +300,26 @@ static int updi_link_check(PROGRAMMER * pgm)
 }
 
 
+/*
+ * Bring the link back up at the given rate after a failed step: a
+ * double break (which returns to the initial rate) resets the UPDI
+ * from whatever error state it is in.
+ */
+static int updi_link_restore(PROGRAMMER * pgm, long baudrate)
+{
+  long initial = pgm->baudrate? pgm->baudrate: 115200;
+
+  if (updi_physical_send_double_break(pgm) < 0 ||
+      updi_link_init_session_parameters(pgm) < 0 ||
+      updi_link_stcs(pgm, UPDI_ASI_CTRLA, UPDI_ASI_CTRLA_UPDICLKSEL_16M) < 0) {
+    return -1;
+  }
+  if (baudrate != initial && updi_physical_set_baud(pgm, baudrate) < 0) {
+    return -1;
+  }
+  return updi_link_check(pgm);
+}
+
 int updi_link_init(PROGRAMMER * pgm)
 {
 /*
@@ -265,6 +343,16 @@ int updi_link_init(PROGRAMMER * pgm)
 
   if (updi_link_check(pgm) < 0) {
     avrdude_message(MSG_DEBUG, "%s: Datalink not active, resetting...\n", progname);
+    /* come back at the raised baud rate if possible */
+    if (updi_get_baud(pgm) > 0) {
+      if (updi_link_restore(pgm, updi_get_baud(pgm)) == 0) {
+        return 0;
+      }
+      avrdude_message(MSG_NOTICE, "%s: Restoring %ld baud failed, falling back to %ld baud\n",
+                      progname, updi_get_baud(pgm), pgm->baudrate? pgm->baudrate: 115200);
+      updi_set_baud(pgm, 0);
+      updi_set_guard_time(pgm, UPDI_CTRLA_GTVAL_128);
+    }
     if (updi_physical_send_double_break(pgm) < 0) {
       avrdude_message(MSG_DEBUG, "%s: Datalink initialisation failed\n", progname);
       return -1;
@@ -281,6 +369,59 @@ int updi_link_init(PROGRAMMER * pgm)
   return 0;
 }
 
+/*
+ * Speed the link up once it has been initialised at the (safe) initial
+ * baud rate: raise the UPDI clock, shorten the guard time, and double
+ * the host baud rate step by step up to baud_max, checking the link
+ * after each step.  The UPDI picks up the new rate from the SYNC
+ * character of the next frame.  When a step fails, back off to the
+ * last rate that worked.
+ *
+ * Return the baud rate in use, or -1 if the link has been lost.
+ */
+long updi_link_escalate_baud(PROGRAMMER * pgm, long baud_max)
+{
+  long initial = pgm->baudrate? pgm->baudrate: 115200;
+  long baudrate = initial;
+  long next;
+
+  updi_set_baud(pgm, 0);
+  if (baud_max <= initial) {
+    return initial;
+  }
+
+  updi_set_guard_time(pgm, UPDI_CTRLA_GTVAL_16);
+  if (updi_link_stcs(pgm, UPDI_ASI_CTRLA, UPDI_ASI_CTRLA_UPDICLKSEL_16M) < 0 ||
+      updi_link_init_session_parameters(pgm) < 0 ||
+      updi_link_check(pgm) < 0) {
+    avrdude_message(MSG_INFO, "%s: Cannot raise UPDI clock, staying at %ld baud\n",
+                    progname, initial);
+    updi_set_guard_time(pgm, UPDI_CTRLA_GTVAL_128);
+    return updi_link_init(pgm) < 0? -1: initial;
+  }
+
+  while (baudrate < baud_max) {
+    next = baudrate * 2 < baud_max? baudrate * 2: baud_max;
+    if (updi_physical_set_baud(pgm, next) == 0 && updi_link_check(pgm) == 0) {
+      baudrate = next;
+      continue;
+    }
+    avrdude_message(MSG_NOTICE, "%s: UPDI link check at %ld baud failed, backing off to %ld baud\n",
+                    progname, next, baudrate);
+    if (updi_link_restore(pgm, baudrate) < 0) {
+      avrdude_message(MSG_NOTICE, "%s: Restoring %ld baud failed, starting over\n",
+                      progname, baudrate);
+      updi_set_guard_time(pgm, UPDI_CTRLA_GTVAL_128);
+      return updi_link_init(pgm) < 0? -1: initial;
+    }
+    break;
+  }
+
+  avrdude_message(MSG_NOTICE, "%s: UPDI link running at %ld baud\n", progname, baudrate);
+  updi_set_baud(pgm, baudrate);
+  return baudrate;
+}
+
 int updi_link_ldcs(PROGRAMMER * pgm, uint8_t address, uint8_t * value) 
 {
 /*
@@ -523,53 +664,19 @@ int updi_link_st_ptr_inc16(PROGRAMMER * pgm, unsigned char * buffer, uint16_t wo
   return 0;
 }
 
-int updi_link_st_ptr_inc16_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_t words, int blocksize) {
 /*
-    def st_ptr_inc16_RSD(self, data, blocksize):
-        """
-        Store a 16-bit word value to the pointer location with pointer post-increment
-        :param data: data to store
-        :blocksize: max number of bytes being sent -1 for all.
-                    Warning: This does not strictly honor blocksize for values < 6
-                    We always glob together the STCS(RSD) and REP commands.
-                    But this should pose no problems for compatibility, because your serial adapter can't deal with 6b chunks,
-                    none of pymcuprog would work!
-        """
-        self.logger.debug("ST16 to *ptr++ with RSD, data length: 0x%03X in blocks of:  %d", len(data), blocksize)
-
-        #for performance we glob everything together into one USB transfer....
-        repnumber= ((len(data) >> 1) -1)
-        data = [*data, *[constants.UPDI_PHY_SYNC, constants.UPDI_STCS | constants.UPDI_CS_CTRLA, 0x06]]
-
-        if blocksize == -1 :
-            # Send whole thing at once stcs + repeat + st + (data + stcs)
-            blocksize = 3 + 3 + 2 + len(data)
-        num = 0
-        firstpacket = []
-        if blocksize < 10 :
-            # very small block size - we send pair of 2-byte commands first.
-            firstpacket = [*[constants.UPDI_PHY_SYNC, constants.UPDI_STCS | constants.UPDI_CS_CTRLA, 0x0E],
-                            *[constants.UPDI_PHY_SYNC, constants.UPDI_REPEAT | constants.UPDI_REPEAT_BYTE, (repnumber & 0xFF)]]
-            data = [*[constants.UPDI_PHY_SYNC, constants.UPDI_ST | constants.UPDI_PTR_INC |constants.UPDI_DATA_16], *data]
-            num = 0
-        else:
-            firstpacket = [*[constants.UPDI_PHY_SYNC, constants.UPDI_STCS | constants.UPDI_CS_CTRLA , 0x0E],
-                            *[constants.UPDI_PHY_SYNC, constants.UPDI_REPEAT | constants.UPDI_REPEAT_BYTE, (repnumber & 0xFF)],
-                            *[constants.UPDI_PHY_SYNC, constants.UPDI_ST | constants.UPDI_PTR_INC | constants.UPDI_DATA_16],
-                            *data[:blocksize - 8]]
-            num = blocksize - 8
-        self.updi_phy.send( firstpacket )
-
-        # if finite block size, this is used.
-        while num < len(data):
-            data_slice = data[num:num+blocksize]
-            self.updi_phy.send(data_slice)
-            num += len(data_slice)
-*/
-  avrdude_message(MSG_DEBUG, "%s: ST16 to *ptr++ with RSD, data length: 0x%03X in blocks of: %d\n", progname, words * 2, blocksize);
-
-  unsigned int temp_buffer_size = 3 + 3 + 2 + (words * 2) + 3;
+ * Stream a block of stores to the pointer location with pointer
+ * post-increment, with the response signature (ACK) disabled for the
+ * duration of the block.  Since the target does not answer, everything
+ * read back is the echo of the stream, which is validated in bulk once
+ * the whole block has been sent.
+ */
+static int updi_link_st_ptr_inc_RSD_common(PROGRAMMER * pgm, unsigned char * buffer, uint16_t size,
+                                           uint8_t data_width, int blocksize)
+{
+  unsigned int temp_buffer_size = 3 + 3 + 2 + size + 3;
   unsigned int num=0;
+  unsigned int units = data_width == UPDI_DATA_16? size >> 1: size;
   unsigned char* temp_buffer = malloc(temp_buffer_size);
 
   if (temp_buffer == 0) {
@@ -583,21 +690,21 @@ int updi_link_st_ptr_inc16_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_
 
   temp_buffer[0] = UPDI_PHY_SYNC;
   temp_buffer[1] = UPDI_STCS | UPDI_CS_CTRLA;
-  temp_buffer[2] = 0x0E;
+  temp_buffer[2] = updi_link_ctrla(pgm) | (1 << UPDI_CTRLA_RSD_BIT);
   temp_buffer[3] = UPDI_PHY_SYNC;
   temp_buffer[4] = UPDI_REPEAT | UPDI_REPEAT_BYTE;
-  temp_buffer[5] = (words - 1) & 0xFF;
+  temp_buffer[5] = (units - 1) & 0xFF;
   temp_buffer[6] = UPDI_PHY_SYNC;
-  temp_buffer[7] = UPDI_ST | UPDI_PTR_INC | UPDI_DATA_16;
+  temp_buffer[7] = UPDI_ST | UPDI_PTR_INC | data_width;
 
-  memcpy(temp_buffer + 8, buffer, words * 2);
+  memcpy(temp_buffer + 8, buffer, size);
 
   temp_buffer[temp_buffer_size-3] = UPDI_PHY_SYNC;
   temp_buffer[temp_buffer_size-2] = UPDI_STCS | UPDI_CS_CTRLA;
-  temp_buffer[temp_buffer_size-1] = 0x06;
+  temp_buffer[temp_buffer_size-1] = updi_link_ctrla(pgm);
 
   if (blocksize < 10) {
-    if (updi_physical_send(pgm, temp_buffer, 6) < 0) {
+    if (updi_physical_send_echoed(pgm, temp_buffer, 6) < 0) {
       avrdude_message(MSG_DEBUG, "%s: Failed to send first package\n", progname);
       free(temp_buffer);
       return -1;
@@ -614,7 +721,7 @@ int updi_link_st_ptr_inc16_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_
       next_package_size = blocksize;
     }
 
-    if (updi_physical_send(pgm, temp_buffer + num, next_package_size) < 0) {
+    if (updi_physical_send_echoed(pgm, temp_buffer + num, next_package_size) < 0) {
       avrdude_message(MSG_DEBUG, "%s: Failed to send package\n", progname);
       free(temp_buffer);
       return -1;
@@ -626,6 +733,61 @@ int updi_link_st_ptr_inc16_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_
   return 0;
 }
 
+int updi_link_st_ptr_inc_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_t size, int blocksize)
+{
+  avrdude_message(MSG_DEBUG, "%s: ST8 to *ptr++ with RSD, data length: 0x%03X in blocks of: %d\n", progname, size, blocksize);
+
+  return updi_link_st_ptr_inc_RSD_common(pgm, buffer, size, UPDI_DATA_8, blocksize);
+}
+
+int updi_link_st_ptr_inc16_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_t words, int blocksize) {
+/*
+    def st_ptr_inc16_RSD(self, data, blocksize):
+        """
+        Store a 16-bit word value to the pointer location with pointer post-increment
+        :param data: data to store
+        :blocksize: max number of bytes being sent -1 for all.
+                    Warning: This does not strictly honor blocksize for values < 6
+                    We always glob together the STCS(RSD) and REP commands.
+                    But this should pose no problems for compatibility, because your serial adapter can't deal with 6b chunks,
+                    none of pymcuprog would work!
+        """
+        self.logger.debug("ST16 to *ptr++ with RSD, data length: 0x%03X in blocks of:  %d", len(data), blocksize)
+
+        #for performance we glob everything together into one USB transfer....
+        repnumber= ((len(data) >> 1) -1)
+        data = [*data, *[constants.UPDI_PHY_SYNC, constants.UPDI_STCS | constants.UPDI_CS_CTRLA, 0x06]]
+
+        if blocksize == -1 :
+            # Send whole thing at once stcs + repeat + st + (data + stcs)
+            blocksize = 3 + 3 + 2 + len(data)
+        num = 0
+        firstpacket = []
+        if blocksize < 10 :
+            # very small block size - we send pair of 2-byte commands first.
+            firstpacket = [*[constants.UPDI_PHY_SYNC, constants.UPDI_STCS | constants.UPDI_CS_CTRLA, 0x0E],
+                            *[constants.UPDI_PHY_SYNC, constants.UPDI_REPEAT | constants.UPDI_REPEAT_BYTE, (repnumber & 0xFF)]]
+            data = [*[constants.UPDI_PHY_SYNC, constants.UPDI_ST | constants.UPDI_PTR_INC |constants.UPDI_DATA_16], *data]
+            num = 0
+        else:
+            firstpacket = [*[constants.UPDI_PHY_SYNC, constants.UPDI_STCS | constants.UPDI_CS_CTRLA , 0x0E],
+                            *[constants.UPDI_PHY_SYNC, constants.UPDI_REPEAT | constants.UPDI_REPEAT_BYTE, (repnumber & 0xFF)],
+                            *[constants.UPDI_PHY_SYNC, constants.UPDI_ST | constants.UPDI_PTR_INC | constants.UPDI_DATA_16],
+                            *data[:blocksize - 8]]
+            num = blocksize - 8
+        self.updi_phy.send( firstpacket )
+
+        # if finite block size, this is used.
+        while num < len(data):
+            data_slice = data[num:num+blocksize]
+            self.updi_phy.send(data_slice)
+            num += len(data_slice)
+*/
+  avrdude_message(MSG_DEBUG, "%s: ST16 to *ptr++ with RSD, data length: 0x%03X in blocks of: %d\n", progname, words * 2, blocksize);
+
+  return updi_link_st_ptr_inc_RSD_common(pgm, buffer, words * 2, UPDI_DATA_16, blocksize);
+}
+
 int updi_link_repeat(PROGRAMMER * pgm, uint16_t repeats)
 {
 /*
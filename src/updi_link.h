@@ -36,12 +36,14 @@ extern "C" {
 int updi_link_open(PROGRAMMER * pgm);
 void updi_link_close(PROGRAMMER * pgm);
 int updi_link_init(PROGRAMMER * pgm);
+long updi_link_escalate_baud(PROGRAMMER * pgm, long baud_max);
 int updi_link_ldcs(PROGRAMMER * pgm, uint8_t address, uint8_t * value);
 int updi_link_stcs(PROGRAMMER * pgm, uint8_t address, uint8_t value);
 int updi_link_ld_ptr_inc(PROGRAMMER * pgm, unsigned char * buffer, uint16_t size);
 int updi_link_ld_ptr_inc16(PROGRAMMER * pgm, unsigned char * buffer, uint16_t words);
 int updi_link_st_ptr_inc(PROGRAMMER * pgm, unsigned char * buffer, uint16_t size);
 int updi_link_st_ptr_inc16(PROGRAMMER * pgm, unsigned char * buffer, uint16_t words);
+int updi_link_st_ptr_inc_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_t size, int blocksize);
 int updi_link_st_ptr_inc16_RSD(PROGRAMMER * pgm, unsigned char * buffer, uint16_t words, int blocksize);
 int updi_link_repeat(PROGRAMMER * pgm, uint16_t repeats);
 int updi_link_read_sib(PROGRAMMER * pgm, unsigned char * buffer, uint16_t size);
@@ -47,6 +47,18 @@ typedef enum
 
 #define USE_DEFAULT_COMMAND 0xFF
 
+/* shortest chip erase time in the datasheets, before polling starts */
+#define NVM_CHIP_ERASE_MIN_US 4000
+
+/*
+ * Polling a chip erase from the start only costs link round trips, so
+ * sleep for the shortest time it can take first.
+ */
+static void nvm_settle_chip_erase(AVRPART * p)
+{
+  usleep(p->chip_erase_delay > 0? p->chip_erase_delay: NVM_CHIP_ERASE_MIN_US);
+}
+
 static int nvm_chip_erase_V0(PROGRAMMER * pgm, AVRPART * p)
 {
 /*
@@ -81,6 +93,7 @@ static int nvm_chip_erase_V0(PROGRAMMER * pgm, AVRPART * p)
     avrdude_message(MSG_INFO, "%s: Chip erase command failed\n", progname);
     return -1;
   }
+  nvm_settle_chip_erase(p);
   if (updi_nvm_wait_ready(pgm, p) < 0) {
     avrdude_message(MSG_INFO, "%s: Wait for ready chip failed\n", progname);
     return -1;
@@ -384,6 +397,7 @@ static int nvm_write_V0(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigned
         if not self.wait_nvm_ready():
             raise PymcuprogError("Timeout waiting for NVM controller to be ready after page write")
 */
+  updi_get_nvm_counters(pgm)->pages++;
   if (updi_nvm_wait_ready(pgm, p) < 0) {
     avrdude_message(MSG_INFO, "%s: Wait for ready chip failed\n", progname);
     return -1;
@@ -456,6 +470,7 @@ static int nvm_chip_erase_V2(PROGRAMMER * pgm, AVRPART * p)
     avrdude_message(MSG_INFO, "%s: Chip erase command failed\n", progname);
     return -1;
   }
+  nvm_settle_chip_erase(p);
   if (updi_nvm_wait_ready(pgm, p) < 0) {
     avrdude_message(MSG_INFO, "%s: Wait for ready chip failed\n", progname);
     return -1;
@@ -652,7 +667,8 @@ static int nvm_write_eeprom_V2(PROGRAMMER * pgm, AVRPART *p, uint32_t address, u
     avrdude_message(MSG_INFO, "%s: EEPROM erase command failed\n", progname);
     return -1;
   }
-  if (updi_write_data(pgm, address, buffer, size) < 0) {
+  /* no page buffer, every store programs NVM directly: keep the ACKs */
+  if (updi_write_data_acked(pgm, address, buffer, size) < 0) {
     avrdude_message(MSG_INFO, "%s: Write data operation failed\n", progname);
     return -1;
   }
@@ -723,6 +739,7 @@ static int nvm_write_V2(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigned
         self.logger.info("Clear NVM command")
         self.execute_nvm_command(constants.UPDI_V2_NVMCTRL_CTRLA_NOCMD)
 */
+  updi_get_nvm_counters(pgm)->pages++;
   if (updi_nvm_wait_ready(pgm, p) < 0) {
     avrdude_message(MSG_INFO, "%s: Wait for ready chip failed\n", progname);
     return -1;
@@ -738,7 +755,7 @@ static int nvm_write_V2(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigned
       return -1;
     }
   } else {
-    if (updi_write_data(pgm, address, buffer, size) < 0) {
+    if (updi_write_data_acked(pgm, address, buffer, size) < 0) {
       avrdude_message(MSG_INFO, "%s: Write data operation failed\n", progname);
       return -1;
     }
@@ -794,6 +811,7 @@ static int nvm_chip_erase_V3(PROGRAMMER * pgm, AVRPART * p)
     avrdude_message(MSG_INFO, "%s: Chip erase command failed\n", progname);
     return -1;
   }
+  nvm_settle_chip_erase(p);
   if (updi_nvm_wait_ready(pgm, p) < 0) {
     avrdude_message(MSG_INFO, "%s: Wait for ready chip failed\n", progname);
     return -1;
@@ -1037,6 +1055,7 @@ static int nvm_write_V3(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigned
         # Remove command
         self.execute_nvm_command(constants.UPDI_V3_NVMCTRL_CTRLA_NOCMD)
 */
+  updi_get_nvm_counters(pgm)->pages++;
   if (updi_nvm_wait_ready(pgm, p) < 0) {
     avrdude_message(MSG_INFO, "%s: Wait for ready chip failed\n", progname);
     return -1;
@@ -1161,6 +1180,30 @@ int updi_nvm_write_flash(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigne
   }
 }
 
+/*
+ * Erase one flash page and write it with a single NVM command where
+ * the controller has one: ERASE_WRITE_PAGE on V0, FLASH_PAGE_ERASE_WRITE
+ * on V3.  V2 has no page buffer and no combined command for flash, so
+ * the page is erased and written in turn there.
+ */
+int updi_nvm_erase_write_flash(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigned char * buffer, uint16_t size)
+{
+  switch(updi_get_nvm_mode(pgm))
+  {
+    case UPDI_NVM_MODE_V0:
+      return nvm_write_V0(pgm, p, address, buffer, size, USE_WORD_ACCESS, UPDI_V0_NVMCTRL_CTRLA_ERASE_WRITE_PAGE);
+    case UPDI_NVM_MODE_V2:
+      if (nvm_erase_flash_page_V2(pgm, p, address) < 0)
+        return -1;
+      return nvm_write_flash_V2(pgm, p, address, buffer, size);
+    case UPDI_NVM_MODE_V3:
+      return nvm_write_V3(pgm, p, address, buffer, size, USE_WORD_ACCESS, UPDI_V3_NVMCTRL_CTRLA_FLASH_PAGE_ERASE_WRITE);
+    default:
+      avrdude_message(MSG_INFO, "%s: Invalid NVM Mode %d\n", progname, updi_get_nvm_mode(pgm));
+      return -1;
+  }
+}
+
 int updi_nvm_write_user_row(PROGRAMMER * pgm, AVRPART *p, uint32_t address, unsigned char * buffer, uint16_t size)
 {
   switch(updi_get_nvm_mode(pgm))
@@ -1209,6 +1252,31 @@ int updi_nvm_write_fuse(PROGRAMMER * pgm, AVRPART *p, uint32_t address, uint8_t
   }
 }
 
+/*
+ * Tell whether an NVM command can leave the controller busy.  Page
+ * buffer clears and the NOP/NOCMD commands never do.  On V2, the
+ * write and erase commands only select a mode, and the data stores
+ * following them start the actual work.
+ */
+static int nvm_command_busy(PROGRAMMER * pgm, uint8_t command)
+{
+  switch(updi_get_nvm_mode(pgm))
+  {
+    case UPDI_NVM_MODE_V0:
+      return command != UPDI_V0_NVMCTRL_CTRLA_NOP &&
+             command != UPDI_V0_NVMCTRL_CTRLA_PAGE_BUFFER_CLR;
+    case UPDI_NVM_MODE_V2:
+      return command != UPDI_V2_NVMCTRL_CTRLA_NOCMD;
+    case UPDI_NVM_MODE_V3:
+      return command != UPDI_V3_NVMCTRL_CTRLA_NOCMD &&
+             command != UPDI_V3_NVMCTRL_CTRLA_NOP &&
+             command != UPDI_V3_NVMCTRL_CTRLA_FLASH_PAGE_BUFFER_CLEAR &&
+             command != UPDI_V3_NVMCTRL_CTRLA_EEPROM_PAGE_BUFFER_CLEAR;
+    default:
+      return 1;
+  }
+}
+
 int updi_nvm_wait_ready(PROGRAMMER * pgm, AVRPART *p)
 {
 /*
@@ -1236,9 +1304,18 @@ int updi_nvm_wait_ready(PROGRAMMER * pgm, AVRPART *p)
   unsigned long current_time;
   struct timeval tv;
   uint8_t status;
+  updi_nvm_counters * counters = updi_get_nvm_counters(pgm);
+
+  /* nothing has been started since the controller was last seen idle */
+  if (!updi_get_nvm_busy(pgm)) {
+    counters->skipped++;
+    return 0;
+  }
+
   gettimeofday (&tv, NULL);
   start_time = (tv.tv_sec * 1000000) + tv.tv_usec;
   do {
+    counters->polls++;
     if (updi_read_byte(pgm, p->nvm_base + UPDI_NVMCTRL_STATUS, &status) >= 0) {
       if (status & (1 << UPDI_NVM_STATUS_WRITE_ERROR)) {
         avrdude_message(MSG_INFO, "%s: NVM error\n", progname);
@@ -1246,6 +1323,7 @@ int updi_nvm_wait_ready(PROGRAMMER * pgm, AVRPART *p)
       }
       if (!(status & ((1 << UPDI_NVM_STATUS_EEPROM_BUSY) | 
                       (1 << UPDI_NVM_STATUS_FLASH_BUSY)))) {
+        updi_set_nvm_busy(pgm, 0);
         return 0;
       }
     }
@@ -1269,7 +1347,12 @@ int updi_nvm_command(PROGRAMMER * pgm, AVRPART *p, uint8_t command)
         self.logger.debug("NVMCMD %d executing", command)
         return self.readwrite.write_byte(self.device.nvmctrl_address + constants.UPDI_NVMCTRL_CTRLA, command)
 */
+  int rc;
+
   avrdude_message(MSG_DEBUG, "%s: NVMCMD %d executing\n", progname, command);
 
-  return updi_write_byte(pgm, p->nvm_base + UPDI_NVMCTRL_CTRLA, command);
+  rc = updi_write_byte(pgm, p->nvm_base + UPDI_NVMCTRL_CTRLA, command);
+  if (rc < 0 || nvm_command_busy(pgm, command))
+    updi_set_nvm_busy(pgm, 1);
+  return rc;
 }
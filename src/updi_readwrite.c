@@ -221,6 +221,36 @@ int updi_write_data(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16
     avrdude_message(MSG_DEBUG, "%s: ST_PTR operation failed\n", progname);
     return -1;
   }
+  if (updi_link_st_ptr_inc_RSD(pgm, buffer, size, -1) == 0) {
+    return 0;
+  }
+  avrdude_message(MSG_DEBUG, "%s: Pipelined write failed, retrying with ACK per byte\n", progname);
+  if (updi_link_init(pgm) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: Datalink recovery failed\n", progname);
+    return -1;
+  }
+  return updi_write_data_acked(pgm, address, buffer, size);
+}
+
+int updi_write_data_acked(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16_t size)
+{
+  /*
+   * Stop-and-wait variant of updi_write_data(): every byte is
+   * acknowledged before the next one is sent.  Needed where a store
+   * may stall the bus, e.g. direct EEPROM writes, and as the fallback
+   * after a failed pipelined write.
+   */
+  if (size <= 2) {
+    return updi_write_data(pgm, address, buffer, size);
+  }
+  if (size > UPDI_MAX_REPEAT_SIZE) {
+    avrdude_message(MSG_DEBUG, "%s: Invalid length\n", progname);
+    return -1;
+  }
+  if (updi_link_st_ptr(pgm, address) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: ST_PTR operation failed\n", progname);
+    return -1;
+  }
   if (updi_link_repeat(pgm, size) < 0) {
     avrdude_message(MSG_DEBUG, "%s: Repeat operation failed\n", progname);
     return -1;
@@ -312,5 +342,21 @@ int updi_write_data_words(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer,
     avrdude_message(MSG_DEBUG, "%s: ST_PTR operation failed\n", progname);
     return -1;
   }
-  return updi_link_st_ptr_inc16_RSD(pgm, buffer, size >> 1, -1);
+  if (updi_link_st_ptr_inc16_RSD(pgm, buffer, size >> 1, -1) == 0) {
+    return 0;
+  }
+  avrdude_message(MSG_DEBUG, "%s: Pipelined write failed, retrying with ACK per word\n", progname);
+  if (updi_link_init(pgm) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: Datalink recovery failed\n", progname);
+    return -1;
+  }
+  if (updi_link_st_ptr(pgm, address) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: ST_PTR operation failed\n", progname);
+    return -1;
+  }
+  if (updi_link_repeat(pgm, size >> 1) < 0) {
+    avrdude_message(MSG_DEBUG, "%s: Repeat operation failed\n", progname);
+    return -1;
+  }
+  return updi_link_st_ptr_inc16(pgm, buffer, size);
 }
@@ -41,6 +41,7 @@ int updi_read_byte(PROGRAMMER * pgm, uint32_t address, uint8_t * value);
 int updi_write_byte(PROGRAMMER * pgm, uint32_t address, uint8_t value);
 int updi_read_data(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16_t size);
 int updi_write_data(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16_t size);
+int updi_write_data_acked(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16_t size);
 int updi_read_data_words(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16_t size);
 int updi_write_data_words(PROGRAMMER * pgm, uint32_t address, uint8_t * buffer, uint16_t size);
 
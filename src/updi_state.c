@@ -53,3 +53,58 @@ void updi_set_nvm_mode(PROGRAMMER * pgm, updi_nvm_mode mode)
 {
   ((updi_state *)(pgm->cookie))->nvm_mode = mode;
 }
+
+uint8_t updi_get_guard_time(PROGRAMMER * pgm)
+{
+  return ((updi_state *)(pgm->cookie))->guard_time;
+}
+
+void updi_set_guard_time(PROGRAMMER * pgm, uint8_t gtval)
+{
+  ((updi_state *)(pgm->cookie))->guard_time = gtval;
+}
+
+long updi_get_baud_max(PROGRAMMER * pgm)
+{
+  return ((updi_state *)(pgm->cookie))->baud_max;
+}
+
+void updi_set_baud_max(PROGRAMMER * pgm, long baud)
+{
+  ((updi_state *)(pgm->cookie))->baud_max = baud;
+}
+
+long updi_get_baud(PROGRAMMER * pgm)
+{
+  return ((updi_state *)(pgm->cookie))->baud;
+}
+
+void updi_set_baud(PROGRAMMER * pgm, long baud)
+{
+  ((updi_state *)(pgm->cookie))->baud = baud;
+}
+
+long updi_get_erase_pending(PROGRAMMER * pgm)
+{
+  return ((updi_state *)(pgm->cookie))->erase_pending;
+}
+
+void updi_set_erase_pending(PROGRAMMER * pgm, long address)
+{
+  ((updi_state *)(pgm->cookie))->erase_pending = address;
+}
+
+uint8_t updi_get_nvm_busy(PROGRAMMER * pgm)
+{
+  return ((updi_state *)(pgm->cookie))->nvm_busy;
+}
+
+void updi_set_nvm_busy(PROGRAMMER * pgm, uint8_t busy)
+{
+  ((updi_state *)(pgm->cookie))->nvm_busy = busy;
+}
+
+updi_nvm_counters* updi_get_nvm_counters(PROGRAMMER * pgm)
+{
+  return &((updi_state *)(pgm->cookie))->nvm_counters;
+}
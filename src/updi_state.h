@@ -61,11 +61,24 @@ typedef struct
   char debug_version;
 } updi_sib_info;
 
+typedef struct
+{
+  unsigned long polls;    /* NVMCTRL.STATUS reads */
+  unsigned long skipped;  /* waits skipped, controller known to be idle */
+  unsigned long pages;    /* page writes */
+} updi_nvm_counters;
+
 typedef struct
 {
   updi_sib_info sib_info;
   updi_datalink_mode datalink_mode;
   updi_nvm_mode nvm_mode;
+  uint8_t guard_time;
+  long baud_max;
+  long baud;              /* link baud rate once escalated, else 0 */
+  long erase_pending;
+  uint8_t nvm_busy;
+  updi_nvm_counters nvm_counters;
 } updi_state;
 
 #ifdef __cplusplus
@@ -77,6 +90,17 @@ updi_datalink_mode updi_get_datalink_mode(PROGRAMMER * pgm);
 void updi_set_datalink_mode(PROGRAMMER * pgm, updi_datalink_mode mode);
 updi_nvm_mode updi_get_nvm_mode(PROGRAMMER * pgm);
 void updi_set_nvm_mode(PROGRAMMER * pgm, updi_nvm_mode mode);
+uint8_t updi_get_guard_time(PROGRAMMER * pgm);
+void updi_set_guard_time(PROGRAMMER * pgm, uint8_t gtval);
+long updi_get_baud_max(PROGRAMMER * pgm);
+void updi_set_baud_max(PROGRAMMER * pgm, long baud);
+long updi_get_baud(PROGRAMMER * pgm);
+void updi_set_baud(PROGRAMMER * pgm, long baud);
+long updi_get_erase_pending(PROGRAMMER * pgm);
+void updi_set_erase_pending(PROGRAMMER * pgm, long address);
+uint8_t updi_get_nvm_busy(PROGRAMMER * pgm);
+void updi_set_nvm_busy(PROGRAMMER * pgm, uint8_t busy);
+updi_nvm_counters* updi_get_nvm_counters(PROGRAMMER * pgm);
 
 #ifdef __cplusplus
 }
@@ -218,5 +218,8 @@ void wiring_initpgm(PROGRAMMER * pgm)
   pgm->setup          = wiring_setup;
   pgm->teardown       = wiring_teardown;
   pgm->parseextparams = wiring_parseextparms;
+
+  /* the bootloader may ignore or only partly do a chip erase */
+  pgm->erase_blanks = 0;
 }
 
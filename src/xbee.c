@@ -1773,6 +1773,9 @@ void xbee_initpgm(PROGRAMMER *pgm)
   pgm->open = xbee_open;
   pgm->close = xbee_close;
 
+  /* the bootloader may ignore or only partly do a chip erase */
+  pgm->erase_blanks = 0;
+
   /*
    * NB: Because we are making use of the STK500 programmer
    * implementation, we can't readily use pgm->cookie ourselves, nor